@@ -8,6 +8,7 @@
  */
 
 #include <limits.h>
+#include <functional>
 #include <memory>
 #include <utility>
 #include <chrono>
@@ -15,6 +16,10 @@
 #include <malloc.h>
 #endif
 #include <type_traits>
+#include <tuple>
+#include <atomic>
+#include <vector>
+#include <iterator>
 
 #include "weights.hpp"
 //#include "atomic.hpp"
@@ -50,6 +55,28 @@ namespace level4 {
 namespace {
 
 #define DATAPAR_THRESHOLD 2048
+
+/* An Output may provide, in addition to `merge(src, dst)`, an
+ * overload `merge(Result&& src, Result& dst)` that is free to steal
+ * the contents of `src`. The intermediate results of a reduction are
+ * dead after they are merged, so they are passed as rvalues whenever
+ * the Output accepts them.
+ */
+template <class Output, class Result>
+auto merge_dead(const Output& out, Result& src, Result& dst, int)
+  -> decltype(out.merge(std::move(src), dst), void()) {
+  out.merge(std::move(src), dst);
+}
+
+template <class Output, class Result>
+void merge_dead(const Output& out, Result& src, Result& dst, long) {
+  out.merge(src, dst);
+}
+
+template <class Output, class Result>
+void merge_dead(const Output& out, Result& src, Result& dst) {
+  merge_dead(out, src, dst, 0);
+}
   
 template <
   class Input,
@@ -87,7 +114,7 @@ void reduce_rec(Input& in,
       }, [&] {
         reduce_rec(in2, out, id, dst2, convert_reduce_comp, convert_reduce, seq_convert_reduce, contr);
       });
-      out.merge(dst2, dst);
+      merge_dead(out, dst2, dst);
     }
   }, [&] {
     seq_convert_reduce(in, dst);
@@ -142,20 +169,26 @@ void reduce(Input& in,
 
 namespace {
   
+// `convert_idx(i, x, dst)` receives the offset i of the item x from
+// in_lo, whatever the direction of the scan
 template <
   class In_iter,
   class Out_iter,
   class Output,
   class Result,
-  class Convert
+  class Convert_idx
 >
-void scan_seq(In_iter in_lo,
+void scan_seq_idx(In_iter in_lo,
               In_iter in_hi,
               Out_iter out_lo,
               const Output& out,
               const Result& id,
-              const Convert& convert,
+              const Convert_idx& convert_idx,
               scan_type st) {
+  if (in_lo == in_hi) {
+    // the backward loops below would step before in_lo
+    return;
+  }
   Result x;
   out.copy(id, x);
   In_iter in_it = in_lo;
@@ -167,7 +200,7 @@ void scan_seq(In_iter in_lo,
       Result tmp1; // required because input and output ranges can overlap
       out.copy(x, tmp1);
       Result tmp2;
-      convert(*in_it, tmp2);
+      convert_idx(in_it - in_lo, *in_it, tmp2);
       out.merge(tmp2, x);
       out.copy(tmp1, *out_it);
     }
@@ -176,7 +209,7 @@ void scan_seq(In_iter in_lo,
     out_it = out_lo;
     for (; in_it != in_hi; in_it++, out_it++) {
       Result tmp;
-      convert(*in_it, tmp);
+      convert_idx(in_it - in_lo, *in_it, tmp);
       out.merge(tmp, x);
       out.copy(x, *out_it);
     }
@@ -189,7 +222,7 @@ void scan_seq(In_iter in_lo,
       Result tmp1; // required because input and output ranges can overlap
       out.copy(x, tmp1);
       Result tmp2;
-      convert(*in_it, tmp2);
+      convert_idx(in_it - in_lo, *in_it, tmp2);
       out.merge(tmp2, x);
       out.copy(tmp1, *out_it);
     }
@@ -200,7 +233,7 @@ void scan_seq(In_iter in_lo,
     out_it = out_lo + m;
     for (; in_it >= in_lo; in_it--, out_it--) {
       Result tmp;
-      convert(*in_it, tmp);
+      convert_idx(in_it - in_lo, *in_it, tmp);
       out.merge(tmp, x);
       out.copy(x, *out_it);
     }
@@ -209,6 +242,25 @@ void scan_seq(In_iter in_lo,
   }
 }
   
+template <
+  class In_iter,
+  class Out_iter,
+  class Output,
+  class Result,
+  class Convert
+>
+void scan_seq(In_iter in_lo,
+              In_iter in_hi,
+              Out_iter out_lo,
+              const Output& out,
+              const Result& id,
+              const Convert& convert,
+              scan_type st) {
+  scan_seq_idx(in_lo, in_hi, out_lo, out, id, [&] (long, reference_of<In_iter> src, Result& dst) {
+    convert(src, dst);
+  }, st);
+}
+  
 template <class In_iter, class Out_iter, class Output, class Result>
 void scan_seq(In_iter in_lo,
               In_iter in_hi,
@@ -285,6 +337,14 @@ static inline std::pair<long,long> get_rng(long k, long n, long i) {
   long hi = std::min(lo + k, n);
   return std::make_pair(lo, hi);
 }
+
+// the arrays of partial results of a scan are allocated uninitialized,
+// and each of their slots gets constructed by the pass that first
+// writes to it, rather than by a separate pass over the arrays
+template <class Result>
+void construct_slot(Result& slot) {
+  new (&slot) Result();
+}
   
 template <class Result, class Output, class Merge_comp>
 void scan_rec(const parray<Result>& ins,
@@ -314,23 +374,17 @@ void scan_rec(const parray<Result>& ins,
       scan_seq(ins, outs_lo, out, id, st);
     } else {
       parray<Result> partials;
-      if (std::is_fundamental<Result>::value) {
-        partials.prefix_tabulate(m, 0);
-      } else {
-        partials.prefix_tabulate(m, m);
-      }
+      partials.prefix_tabulate(m, 0);
+      parray<Result> scans;
+      scans.prefix_tabulate(m, 0);
       parallel_for(0l, m, /*loop_comp,*/ [&] (long i) {
         auto beg = ins.cbegin();
         long lo = get_rng(k, n, i).first;
         long hi = get_rng(k, n, i).second;
+        construct_slot(partials[i]);
+        construct_slot(scans[i]);
         out.merge(beg+lo, beg+hi, partials[i]);
       });
-      parray<Result> scans;
-      if (std::is_fundamental<Result>::value) {
-        scans.prefix_tabulate(m, 0);
-      } else {
-        scans.prefix_tabulate(m, m);
-      }
       auto st2 = (is_backward_scan(st)) ? backward_exclusive_scan : forward_exclusive_scan;
       scan_rec(partials, scans.begin(), out, id, merge_comp, st2);
       parallel_for(0l, m, /*loop_comp,*/ [&] (long i) {
@@ -391,23 +445,17 @@ void scan(Input& in,
     } else {
       parray<Input> splits = in.split(m);
       parray<Result> partials;
-      if (std::is_fundamental<Result>::value) {
-        partials.prefix_tabulate(m, 0);
-      } else {
-        partials.prefix_tabulate(m, m);
-      }
+      partials.prefix_tabulate(m, 0);
+      parray<Result> scans;
+      scans.prefix_tabulate(m, 0);
       parallel_for(0l, m, /*loop_comp,*/ [&] (long i) {
         long lo = get_rng(k, n, i).first;
         long hi = get_rng(k, n, i).second;
         Input in2 = in.slice(splits, lo, hi);
+        construct_slot(partials[i]);
+        construct_slot(scans[i]);
         convert_reduce(in2, partials[i]);
       });
-      parray<Result> scans;
-      if (std::is_fundamental<Result>::value) {
-        scans.prefix_tabulate(m, 0);
-      } else {
-        scans.prefix_tabulate(m, m);
-      }
       auto st2 = (is_backward_scan(st)) ? backward_exclusive_scan : forward_exclusive_scan;
       scan_rec(partials, scans.begin(), out, id, merge_comp, st2);
       parallel_for(0l, m, /*loop_comp,*/ [&] (long i) {
@@ -583,8 +631,8 @@ void scan(Input_iter lo,
   };
   auto convert_scan = [&] (Result _id, input_type& in, Output_iter outs_lo) {
     long pos = in.lo - lo;
-    level4::scan_seq(in.lo, in.hi, outs_lo, out, _id, [&] (reference_of<Input_iter> src, Result& dst) {
-      lift_idx_dst(pos++, src, dst);
+    level4::scan_seq_idx(in.lo, in.hi, outs_lo, out, _id, [&] (long i, reference_of<Input_iter> src, Result& dst) {
+      lift_idx_dst(pos + i, src, dst);
     }, st);
   };
   auto seq_convert_scan = [&] (Result _id, input_type& in, Output_iter outs_lo) {
@@ -641,10 +689,14 @@ public:
     dst = combine(dst, src);
   }
   
+  void merge(result_type&& src, result_type& dst) const {
+    dst = combine(std::move(dst), std::move(src));
+  }
+  
   void merge(const_iterator lo, const_iterator hi, result_type& dst) const {
     dst = id;
     for (const_iterator it = lo; it != hi; it++) {
-      dst = combine(*it, dst);
+      dst = combine(std::move(dst), *it);
     }
   }
   
@@ -913,8 +965,8 @@ parray<Result> scani(Iter lo,
   using iterator = typename parray<Result>::iterator;
   auto seq_scan_rng_dst = [&] (Result _id, Iter _lo, Iter _hi, iterator outs_lo) {
     long pos = _lo - lo;
-    level4::scan_seq(_lo, _hi, outs_lo, out, _id, [&] (reference_of<Iter> src, Result& dst) {
-      dst = lift_idx(pos++, src);
+    level4::scan_seq_idx(_lo, _hi, outs_lo, out, _id, [&] (long i, reference_of<Iter> src, Result& dst) {
+      dst = lift_idx(pos + i, src);
     }, st);
   };
   return level2::scan(lo, hi, id, combine, lift_comp_rng, lift_idx, seq_scan_rng_dst, st);
@@ -966,8 +1018,8 @@ parray<Result> scani(Iter lo,
   using iterator = typename parray<Result>::iterator;
   auto seq_scan_rng_dst = [&] (Result _id, Iter _lo, Iter _hi, iterator outs_lo) {
     long pos = _lo - lo;
-    level4::scan_seq(_lo, _hi, outs_lo, out, _id, [&] (reference_of<Iter> src, Result& dst) {
-      dst = lift_idx(pos++, src);
+    level4::scan_seq_idx(_lo, _hi, outs_lo, out, _id, [&] (long i, reference_of<Iter> src, Result& dst) {
+      dst = lift_idx(pos + i, src);
     }, st);
   };
   return level2::scan(lo, hi, id, combine, lift_comp_rng, lift_idx, seq_scan_rng_dst, st);
@@ -1180,93 +1232,122 @@ long max_index(Iter lo, Iter hi, const Item& id, const Comp& comp) {
 /*---------------------------------------------------------------------*/
 namespace dps {
 template <
-  class Iter,
+  class Input_iter,
   class Item,
-  class Combine
+  class Combine,
+  class Output_iter
 >
-Item scan(Iter lo,
-          Iter hi,
+Item scan(Input_iter lo,
+          Input_iter hi,
           Item id,
           const Combine& combine,
-          Iter outs_lo, scan_type st);
+          Output_iter outs_lo,
+          scan_type st);
 }
 
 /*---------------------------------------------------------------------*/
 /* Pack and filter */
   
 namespace __priv {
-    
+  
+// Writes f(i), for each i in [0, n) such that keep(i) holds, to
+// consecutive positions of the range returned by out(m), where m is
+// the number of such i. Each keep(i) is evaluated once, in the
+// counting pass, which records the outcome in one bit per position;
+// the writing pass reads these bits instead of evaluating keep again.
 template <
-  class Flags_iter,
-  class Iter,
-  class Item,
+  class Keep_idx,
   class Output,
   class F
 >
-long pack(Flags_iter flags_lo, Iter lo, Iter hi, Item&, const Output& out, const F f) {
-  long n = hi - lo;
+long pack_if(long n, const Keep_idx& keep, const Output& out, const F& f) {
+  using word_type = unsigned long long;
+  const long word_bits = 64;
   if (n < 1) {
     return 0;
   }
-  auto combine = [&] (long x, long y) {
-    return x + y;
+  // sets the bits of [l, r), where l is a multiple of word_bits, and
+  // returns the number of bits set
+  auto count = [&] (word_type* flags, long l, long r) {
+    long total = 0;
+    for (long w = l / word_bits; w * word_bits < r; w++) {
+      long lo = w * word_bits;
+      long hi = std::min(r, lo + word_bits);
+      word_type word = 0;
+      for (long i = lo; i < hi; i++) {
+        if (keep(i)) {
+          word |= word_type(1) << (i - lo);
+          total++;
+        }
+      }
+      flags[w] = word;
+    }
+    return total;
   };
-  auto lift = [&] (reference_of<Flags_iter> x) {
-    return (long)x;
+  auto is_set = [&] (const word_type* flags, long i) {
+    return ((flags[i / word_bits] >> (i % word_bits)) & 1) != 0;
   };
 
   if (n <= DATAPAR_THRESHOLD) {
-    int total = 0;
-    for (int i = 0; i < n; i++) {
-      if (flags_lo[i]) {
-         total++;
+    word_type flags[(DATAPAR_THRESHOLD + word_bits - 1) / word_bits];
+    auto dst_lo = out(count(flags, 0, n));
+    long total = 0;
+    for (long i = 0; i < n; i++) {
+      if (is_set(flags, i)) {
+        dst_lo[total] = f(i);
+        total++;
       }
     }
-    auto dst_lo = out(total);
-    total = 0;
-    for (int i = 0; i < n; i++) {
-      if (flags_lo[i]) {
-        dst_lo[total++] = lo[i];
-      }
-    } return total;
+    return total;
   }
 
+  // DATAPAR_THRESHOLD is a multiple of word_bits, so that no two
+  // blocks share a word of flags
+  parray<word_type> flags((n + word_bits - 1) / word_bits);
   long len = (n + DATAPAR_THRESHOLD - 1) / DATAPAR_THRESHOLD;
-  auto body = [&] (long i) {
-    long l = i * DATAPAR_THRESHOLD;
-    long r = std::min((i + 1) * DATAPAR_THRESHOLD, n);
-    return level1::reduce(flags_lo + l, flags_lo + r, 0L, combine, lift);
+  parray<long> sizes(len, [&] (long b) {
+    long l = b * DATAPAR_THRESHOLD;
+    long r = std::min((b + 1) * DATAPAR_THRESHOLD, n);
+    return count(flags.begin(), l, r);
+  });
+  auto combine = [&] (long x, long y) {
+    return x + y;
   };
-  parray<long> sizes(len, body);
-
   long m = dps::scan(sizes.begin(), sizes.end(), 0L, combine, sizes.begin(), forward_exclusive_scan);
-  
 
   auto dst_lo = out(m);
-  
-  range::parallel_for(0L, len, [&] (long l, long r) { return r - l; }, [&, dst_lo, flags_lo, sizes] (long i) {
-    long l = i * DATAPAR_THRESHOLD;
-    long r = std::min(n, (i + 1) * DATAPAR_THRESHOLD);
-    long b = i;
-    long offset = sizes[b];
-    for (int i = l; i < r; i++) {
-      if (flags_lo[i]) {
-        dst_lo[offset++] = f(i, lo[i]);
-      }
-    }
-  }, [&, dst_lo, flags_lo, sizes] (long l, long r) {
-    long ll = l * DATAPAR_THRESHOLD;
-    long rr = std::min(n, (r + 1) * DATAPAR_THRESHOLD);
-    long offset = sizes[l];
-    for (int i = ll; i < rr; i++) {
-      if (flags_lo[i]) {
-        dst_lo[offset++] = f(i, lo[i]);
+
+  auto write = [&, dst_lo] (long bl, long br) {
+    long l = bl * DATAPAR_THRESHOLD;
+    long r = std::min(n, br * DATAPAR_THRESHOLD);
+    long offset = sizes[bl];
+    for (long i = l; i < r; i++) {
+      if (is_set(flags.cbegin(), i)) {
+        dst_lo[offset++] = f(i);
       }
     }
-  });
+  };
+  range::parallel_for(0L, len, [&] (long l, long r) { return r - l; }, [&] (long b) {
+    write(b, b + 1);
+  }, write);
 
   return m;
 }
+    
+template <
+  class Flags_iter,
+  class Iter,
+  class Item,
+  class Output,
+  class F
+>
+long pack(Flags_iter flags_lo, Iter lo, Iter hi, Item&, const Output& out, const F f) {
+  return pack_if(hi - lo, [&] (long i) {
+    return (bool)flags_lo[i];
+  }, out, [&] (long i) {
+    return f(i, lo[i]);
+  });
+}
 
 } // end namespace
   
@@ -1341,6 +1422,278 @@ parray<value_type_of<Iter>> filter(Iter lo, Iter hi, const Pred& pred) {
   return filteri(lo, hi, pred_idx);
 }
   
+/*---------------------------------------------------------------------*/
+/* Unique, adjacent difference and run-length encoding */
+  
+template <class Iter, class Equal>
+parray<value_type_of<Iter>> unique(Iter lo, Iter hi, const Equal& equal) {
+  parray<value_type_of<Iter>> dst;
+  __priv::pack_if(hi - lo, [&] (long i) {
+    return i == 0 || ! equal(lo[i - 1], lo[i]);
+  }, [&] (long m) {
+    dst.prefix_tabulate(m, 0);
+    return dst.begin();
+  }, [&] (long i) {
+    return lo[i];
+  });
+  return dst;
+}
+  
+template <class Iter>
+parray<value_type_of<Iter>> unique(Iter lo, Iter hi) {
+  return pasl::pctl::unique(lo, hi, std::equal_to<value_type_of<Iter>>());
+}
+  
+template <class Iter, class Equal>
+long unique_count(Iter lo, Iter hi, const Equal& equal) {
+  long n = hi - lo;
+  if (n < 1) {
+    return 0;
+  }
+  auto combine = [&] (long x, long y) {
+    return x + y;
+  };
+  auto lift_idx = [&] (long i, reference_of<Iter>) {
+    return (i == 0 || ! equal(lo[i - 1], lo[i])) ? 1L : 0L;
+  };
+  return level1::reducei(lo, hi, 0L, combine, lift_idx);
+}
+  
+template <class Iter>
+long unique_count(Iter lo, Iter hi) {
+  return pasl::pctl::unique_count(lo, hi, std::equal_to<value_type_of<Iter>>());
+}
+  
+template <class Iter, class Difference>
+parray<value_type_of<Iter>> adjacent_difference(Iter lo, Iter hi, const Difference& difference) {
+  return parray<value_type_of<Iter>>(hi - lo, [&] (long i) {
+    return (i == 0) ? lo[0] : difference(lo[i], lo[i - 1]);
+  });
+}
+  
+template <class Iter>
+parray<value_type_of<Iter>> adjacent_difference(Iter lo, Iter hi) {
+  using value_type = value_type_of<Iter>;
+  return pasl::pctl::adjacent_difference(lo, hi, [&] (const value_type& x, const value_type& y) {
+    return x - y;
+  });
+}
+  
+// Returns, for each maximal run of equal consecutive items, the pair
+// consisting of the first item of the run and the length of the run.
+template <class Iter, class Equal>
+parray<std::pair<value_type_of<Iter>, long>> run_length_encode(Iter lo, Iter hi, const Equal& equal) {
+  long n = hi - lo;
+  parray<long> starts;
+  long m = __priv::pack_if(n, [&] (long i) {
+    return i == 0 || ! equal(lo[i - 1], lo[i]);
+  }, [&] (long m) {
+    starts.prefix_tabulate(m, 0);
+    return starts.begin();
+  }, [&] (long i) {
+    return i;
+  });
+  return parray<std::pair<value_type_of<Iter>, long>>(m, [&] (long j) {
+    long l = starts[j];
+    long r = (j + 1 < m) ? starts[j + 1] : n;
+    return std::make_pair(lo[l], r - l);
+  });
+}
+  
+template <class Iter>
+parray<std::pair<value_type_of<Iter>, long>> run_length_encode(Iter lo, Iter hi) {
+  return pasl::pctl::run_length_encode(lo, hi, std::equal_to<value_type_of<Iter>>());
+}
+  
+/*---------------------------------------------------------------------*/
+/* Swap ranges, reverse and rotate */
+
+/* Exchanges the items of [lo, hi) with those of the range of the same
+ * size that starts at `dst`, and returns the end of the latter. The two
+ * ranges must not overlap.
+ */
+template <class Iter, class Output_iter>
+Output_iter swap_ranges(Iter lo, Iter hi, Output_iter dst) {
+  long n = hi - lo;
+  range::parallel_for(0L, n, [&] (long l, long r) { return r - l; }, [&] (long i) {
+    std::iter_swap(lo + i, dst + i);
+  }, [&] (long l, long r) {
+    std::swap_ranges(lo + l, lo + r, dst + l);
+  });
+  return dst + n;
+}
+
+/* Reverses the items of [lo, hi) in place. The i-th item of the first
+ * half is exchanged with the i-th item from the end, so the loop runs
+ * over half of the range.
+ */
+template <class Iter>
+void reverse(Iter lo, Iter hi) {
+  long h = (hi - lo) / 2;
+  range::parallel_for(0L, h, [&] (long l, long r) { return r - l; }, [&] (long i) {
+    std::iter_swap(lo + i, hi - 1 - i);
+  }, [&] (long l, long r) {
+    std::swap_ranges(lo + l, lo + r, std::reverse_iterator<Iter>(hi - l));
+  });
+}
+
+/* Reorders the items of [lo, hi) in place so that `mid` becomes the
+ * first item, and returns an iterator on the new position of the item
+ * that was first. When the two parts have the same size, they are
+ * exchanged directly. Otherwise, each part is reversed, then the whole
+ * range, for a total of (hi - lo) swaps.
+ */
+template <class Iter>
+Iter rotate(Iter lo, Iter mid, Iter hi) {
+  if (mid == lo) {
+    return hi;
+  }
+  if (mid == hi) {
+    return lo;
+  }
+  long k = mid - lo;
+  long n = hi - lo;
+  if (2 * k == n) {
+    pasl::pctl::swap_ranges(lo, mid, mid);
+    return mid;
+  }
+  pasl::pctl::reverse(lo, mid);
+  pasl::pctl::reverse(mid, hi);
+  pasl::pctl::reverse(lo, hi);
+  return lo + (n - k);
+}
+
+/*---------------------------------------------------------------------*/
+/* Partition */
+  
+#define DATAPAR_PARTITION_MAX_BLOCKS 1024
+  
+namespace __priv {
+  
+// the intervals [starts[i], starts[i] + (offsets[i + 1] - offsets[i]))
+// laid end to end; offsets[0] is zero
+class interval_list {
+public:
+  
+  std::vector<long> starts;
+  std::vector<long> offsets;
+  
+  interval_list() {
+    offsets.push_back(0);
+  }
+  
+  void push_back(long lo, long hi) {
+    if (lo < hi) {
+      starts.push_back(lo);
+      offsets.push_back(offsets.back() + (hi - lo));
+    }
+  }
+  
+  long size() const {
+    return offsets.back();
+  }
+  
+  // index of the interval that holds the t-th position
+  long interval_of(long t) const {
+    return std::upper_bound(offsets.begin(), offsets.end(), t) - offsets.begin() - 1;
+  }
+  
+};
+  
+} // end namespace
+  
+/* Reorders the items of [lo, hi) so that the items that satisfy `pred`
+ * come before the others, and returns an iterator on the first item of
+ * the second group. The relative order of the items is not preserved.
+ * The range is cut in blocks, which are partitioned independently.
+ * Afterward, the items that lie on the wrong side of the final
+ * boundary form two lists of intervals of the same total size, and are
+ * exchanged by a parallel loop. Besides the input, the space used is
+ * linear in the number of blocks.
+ */
+template <class Iter, class Pred>
+Iter partition(Iter lo, Iter hi, const Pred& pred) {
+  long n = hi - lo;
+  if (n <= DATAPAR_THRESHOLD) {
+    return std::partition(lo, hi, pred);
+  }
+  long block_size = std::max((long)DATAPAR_THRESHOLD, (n + DATAPAR_PARTITION_MAX_BLOCKS - 1) / DATAPAR_PARTITION_MAX_BLOCKS);
+  long nb_blocks = (n + block_size - 1) / block_size;
+  parray<long> mids(nb_blocks, [&] (long b) {
+    long l = b * block_size;
+    long r = std::min(n, l + block_size);
+    return std::partition(lo + l, lo + r, pred) - lo;
+  });
+  long m = 0;
+  for (long b = 0; b < nb_blocks; b++) {
+    m += mids[b] - b * block_size;
+  }
+  // items that fail `pred` before m, and items that satisfy it after m
+  __priv::interval_list xs;
+  __priv::interval_list ys;
+  for (long b = 0; b < nb_blocks; b++) {
+    long l = b * block_size;
+    long r = std::min(n, l + block_size);
+    xs.push_back(mids[b], std::min(r, m));
+    ys.push_back(std::max(l, m), mids[b]);
+  }
+  assert(xs.size() == ys.size());
+  long nb_swaps = xs.size();
+  long nb_swap_blocks = (nb_swaps + DATAPAR_THRESHOLD - 1) / DATAPAR_THRESHOLD;
+  auto swap_blocks = [&] (long bl, long br) {
+    long t = bl * DATAPAR_THRESHOLD;
+    long t_hi = std::min(nb_swaps, br * DATAPAR_THRESHOLD);
+    long i = xs.interval_of(t);
+    long j = ys.interval_of(t);
+    for (; t < t_hi; t++) {
+      while (xs.offsets[i + 1] <= t) {
+        i++;
+      }
+      while (ys.offsets[j + 1] <= t) {
+        j++;
+      }
+      std::iter_swap(lo + xs.starts[i] + (t - xs.offsets[i]), lo + ys.starts[j] + (t - ys.offsets[j]));
+    }
+  };
+  range::parallel_for(0L, nb_swap_blocks, [&] (long l, long r) { return (r - l) * DATAPAR_THRESHOLD; }, [&] (long b) {
+    swap_blocks(b, b + 1);
+  }, swap_blocks);
+  return lo + m;
+}
+  
+/* Same as `partition`, but preserves the relative order of the items
+ * within each group. The items are packed into a temporary array, and
+ * then copied back, so the space used is linear in the input.
+ */
+template <class Iter, class Pred>
+Iter stable_partition(Iter lo, Iter hi, const Pred& pred) {
+  using value_type = value_type_of<Iter>;
+  long n = hi - lo;
+  if (n <= DATAPAR_THRESHOLD) {
+    return std::stable_partition(lo, hi, pred);
+  }
+  parray<bool> flags(n, [&] (long i) {
+    return (bool)pred(lo[i]);
+  });
+  parray<value_type> tmp(n);
+  long m = __priv::pack_if(n, [&] (long i) {
+    return flags[i];
+  }, [&] (long) {
+    return tmp.begin();
+  }, [&] (long i) {
+    return lo[i];
+  });
+  __priv::pack_if(n, [&] (long i) {
+    return ! flags[i];
+  }, [&] (long) {
+    return tmp.begin() + m;
+  }, [&] (long i) {
+    return lo[i];
+  });
+  pmem::copy(tmp.cbegin(), tmp.cend(), lo);
+  return lo + m;
+}
+  
 /*---------------------------------------------------------------------*/
 /* Array-sum and max */
   
@@ -1370,83 +1723,865 @@ value_type_of<Iter> min(Iter lo, Iter hi) {
   });
 }
   
-/***********************************************************************/
+/*---------------------------------------------------------------------*/
+/* Search */
 
-namespace dps {
+namespace {
   
-/*---------------------------------------------------------------------*/
-/* Reduction level 2 */
+template <class Item>
+void write_min(std::atomic<Item>& cell, Item x) {
+  Item y = cell.load();
+  while (x < y && ! cell.compare_exchange_weak(y, x)) { }
+}
   
-namespace level2 {
+template <class Pred_idx>
+class find_first_index_contr {
+public:
+  static controller_type contr;
+};
 
-template <
-  class Input_iter,
-  class Result,
-  class Output_iter,
-  class Combine,
-  class Lift_comp_rng,
-  class Lift_idx,
-  class Seq_scan_rng_dst
-  >
-void scan(Input_iter lo,
-          Input_iter hi,
-          Result& id,
-          const Combine& combine,
-          Output_iter outs_lo,
-          const Lift_comp_rng& lift_comp_rng,
-          const Lift_idx& lift_idx,
-          const Seq_scan_rng_dst& seq_scan_rng_dst,
-          scan_type st) {
-  using output_type = level3::cell_output<Result, Combine>;
-  output_type out(id, combine);
-  auto lift_idx_dst = [&] (long pos, reference_of<Input_iter> x, Result& dst) {
-    dst = lift_idx(pos, x);
+template <class Pred_idx>
+controller_type find_first_index_contr<Pred_idx>::contr("find_first_index"+sota<Pred_idx>());
+
+// Visits the indices [lo, hi) that are to the left of the smallest
+// match recorded in `first`, and records there any match found. The
+// leaves give up as soon as a match has been found to their left.
+// Returns true if no leaf gave up, so that only the leaves that
+// visited their whole range are reported to the granularity controller.
+template <class Pred_idx>
+bool find_first_index_par(long lo, long hi, std::atomic<long>& first, const Pred_idx& pred_idx) {
+  using controller_type = find_first_index_contr<Pred_idx>;
+  if (lo >= hi) {
+    return true;
+  }
+  if (lo >= first.load(std::memory_order_relaxed)) {
+    return false;
+  }
+  auto seq_body = [&] {
+    for (long i = lo; i < hi; i++) {
+      if (i >= first.load(std::memory_order_relaxed)) {
+        return false;
+      }
+      if (pred_idx(i)) {
+        write_min(first, i);
+        return false;
+      }
+    }
+    return true;
   };
-  level3::scan(lo, hi, out, id, outs_lo, lift_comp_rng, lift_idx_dst, seq_scan_rng_dst, st);
+#ifdef MANUAL_CONTROL
+  if (hi - lo <= DATAPAR_THRESHOLD) {
+    return seq_body();
+  }
+#endif
+  return par::cstmt_early_exit(controller_type::contr, [&] { return hi - lo; }, [&] {
+    if (hi - lo == 1) {
+      return seq_body();
+    }
+    long mid = lo + (hi - lo) / 2;
+    bool completed1 = true;
+    bool completed2 = true;
+    par::fork2([&] {
+      completed1 = find_first_index_par(lo, mid, first, pred_idx);
+    }, [&] {
+      completed2 = find_first_index_par(mid, hi, first, pred_idx);
+    });
+    return completed1 && completed2;
+  }, seq_body);
+}
+
+// Returns the smallest index i in [0, n) such that pred_idx(i) holds,
+// or n if there is no such index. The indices are visited in rounds of
+// doubling size, and the search stops after the first round that finds
+// a match; thus, the work is proportional to the position of the
+// first match.
+template <class Pred_idx>
+long find_first_index_rec(long n, const Pred_idx& pred_idx) {
+  std::atomic<long> first(n);
+  long lo = 0;
+  long k = DATAPAR_THRESHOLD;
+  while (lo < n) {
+    long hi = std::min(n, lo + k);
+    find_first_index_par(lo, hi, first, pred_idx);
+    if (first.load() < n) {
+      break;
+    }
+    lo = hi;
+    k *= 2;
+  }
+  return first.load();
 }
   
 } // end namespace
-  
-/*---------------------------------------------------------------------*/
-/* Reduction level 1 */
-  
-namespace level1 {
-  
-template <
-  class Input_iter,
-  class Result,
-  class Output_iter,
-  class Combine,
-  class Lift_comp_idx,
-  class Lift_idx
->
-Result scani(Input_iter lo,
-             Input_iter hi,
-             Result& id,
+
+template <class Iter, class Pred>
+long find_first_index(Iter lo, Iter hi, const Pred& pred) {
+  return find_first_index_rec(hi - lo, [&] (long i) {
+    return pred(*(lo + i));
+  });
+}
+
+template <class Iter, class Pred>
+Iter find_if(Iter lo, Iter hi, const Pred& pred) {
+  return lo + find_first_index(lo, hi, pred);
+}
+
+template <class Iter, class Item>
+Iter find(Iter lo, Iter hi, const Item& x) {
+  return find_if(lo, hi, [&] (reference_of<Iter> y) {
+    return y == x;
+  });
+}
+
+template <class Iter, class Pred>
+bool any_of(Iter lo, Iter hi, const Pred& pred) {
+  return find_first_index(lo, hi, pred) < (hi - lo);
+}
+
+template <class Iter, class Pred>
+bool all_of(Iter lo, Iter hi, const Pred& pred) {
+  return ! any_of(lo, hi, [&] (reference_of<Iter> x) {
+    return ! pred(x);
+  });
+}
+
+template <class Iter, class Pred>
+bool none_of(Iter lo, Iter hi, const Pred& pred) {
+  return ! any_of(lo, hi, pred);
+}
+
+template <class Iter1, class Iter2, class Equal>
+std::pair<Iter1, Iter2> mismatch(Iter1 lo1, Iter1 hi1, Iter2 lo2, const Equal& equal) {
+  long i = find_first_index_rec(hi1 - lo1, [&] (long i) {
+    return ! equal(*(lo1 + i), *(lo2 + i));
+  });
+  return std::make_pair(lo1 + i, lo2 + i);
+}
+
+template <class Iter1, class Iter2>
+std::pair<Iter1, Iter2> mismatch(Iter1 lo1, Iter1 hi1, Iter2 lo2) {
+  return mismatch(lo1, hi1, lo2, [&] (reference_of<Iter1> x, reference_of<Iter2> y) {
+    return x == y;
+  });
+}
+  
+template <class Iter, class Compare>
+Iter is_sorted_until(Iter lo, Iter hi, const Compare& compare) {
+  long n = hi - lo;
+  if (n < 2) {
+    return hi;
+  }
+  return lo + 1 + find_first_index_rec(n - 1, [&] (long i) {
+    return compare(*(lo + i + 1), *(lo + i));
+  });
+}
+
+template <class Iter, class Compare>
+bool is_sorted(Iter lo, Iter hi, const Compare& compare) {
+  return pasl::pctl::is_sorted_until(lo, hi, compare) == hi;
+}
+  
+/*---------------------------------------------------------------------*/
+/* Multi-reduction */
+
+/* A reducer bundles the identity, combining operator and lift function
+ * of one reduction. Several reducers can be passed together to
+ * `reduce`, so that all of the reductions are computed by a single
+ * traversal of the input sequence.
+ */
+template <class Result, class Combine, class Lift>
+class reducer {
+public:
+  
+  using result_type = Result;
+  
+  Result id;
+  Combine combine;
+  Lift lift;
+  
+  reducer(Result id, Combine combine, Lift lift)
+  : id(id), combine(combine), lift(lift) { }
+  
+};
+
+template <class Result, class Combine, class Lift>
+reducer<Result, Combine, Lift> make_reducer(Result id, Combine combine, Lift lift) {
+  return reducer<Result, Combine, Lift>(id, combine, lift);
+}
+
+namespace {
+  
+template <class Reducers>
+class multi_reduce_result;
+  
+template <class... Reducers>
+class multi_reduce_result<std::tuple<Reducers...>> {
+public:
+  using type = std::tuple<typename Reducers::result_type...>;
+};
+
+// applies, one reducer after the other, the operations on the i-th
+// through the last components of a tuple of reducers; the recursion is
+// resolved at compile time, so that the loop in the leaves consists of
+// straight-line code
+template <long i, long n>
+class multi_reduce_step {
+public:
+  
+  template <class Reducers, class Results>
+  static void init(const Reducers& rs, Results& dst) {
+    std::get<i>(dst) = std::get<i>(rs).id;
+    multi_reduce_step<i + 1, n>::init(rs, dst);
+  }
+  
+  template <class Reducers, class Results, class Item>
+  static void lift_combine(const Reducers& rs, Results& dst, const Item& x) {
+    auto& r = std::get<i>(rs);
+    std::get<i>(dst) = r.combine(std::get<i>(dst), r.lift(x));
+    multi_reduce_step<i + 1, n>::lift_combine(rs, dst, x);
+  }
+  
+  template <class Reducers, class Results>
+  static void merge(const Reducers& rs, const Results& src, Results& dst) {
+    std::get<i>(dst) = std::get<i>(rs).combine(std::get<i>(dst), std::get<i>(src));
+    multi_reduce_step<i + 1, n>::merge(rs, src, dst);
+  }
+  
+};
+  
+template <long n>
+class multi_reduce_step<n, n> {
+public:
+  
+  template <class Reducers, class Results>
+  static void init(const Reducers&, Results&) { }
+  
+  template <class Reducers, class Results, class Item>
+  static void lift_combine(const Reducers&, Results&, const Item&) { }
+  
+  template <class Reducers, class Results>
+  static void merge(const Reducers&, const Results&, Results&) { }
+  
+};
+  
+template <class Reducers>
+class multi_output {
+public:
+  
+  using result_type = typename multi_reduce_result<Reducers>::type;
+  using array_type = parray<result_type>;
+  using const_iterator = typename array_type::const_iterator;
+  using step = multi_reduce_step<0, std::tuple_size<Reducers>::value>;
+  
+  Reducers reducers;
+  
+  multi_output(const Reducers& reducers)
+  : reducers(reducers) { }
+  
+  void init(result_type& dst) const {
+    step::init(reducers, dst);
+  }
+  
+  void copy(const result_type& src, result_type& dst) const {
+    dst = src;
+  }
+  
+  void merge(const result_type& src, result_type& dst) const {
+    step::merge(reducers, src, dst);
+  }
+  
+  void merge(const_iterator lo, const_iterator hi, result_type& dst) const {
+    init(dst);
+    for (const_iterator it = lo; it != hi; it++) {
+      merge(*it, dst);
+    }
+  }
+  
+  template <class Iter>
+  void reduce_seq(Iter lo, Iter hi, result_type& dst) const {
+    result_type acc;
+    init(acc);
+    for (Iter it = lo; it != hi; it++) {
+      step::lift_combine(reducers, acc, *it);
+    }
+    dst = acc;
+  }
+  
+};
+  
+} // end namespace
+
+/* Computes, by a single traversal of [lo, hi), the reduction of each of
+ * the reducers in `reducers`, which is a tuple of objects created by
+ * `make_reducer`. The i-th component of the result is the result of the
+ * i-th reducer.
+ */
+template <class Iter, class... Reducers>
+std::tuple<typename Reducers::result_type...> reduce(Iter lo,
+                                                     Iter hi,
+                                                     const std::tuple<Reducers...>& reducers) {
+  using output_type = multi_output<std::tuple<Reducers...>>;
+  using result_type = typename output_type::result_type;
+  using input_type = level4::random_access_iterator_input<Iter>;
+  output_type out(reducers);
+  result_type id;
+  out.init(id);
+  result_type dst;
+  out.init(dst);
+  input_type in(lo, hi);
+  auto convert_reduce_comp = [&] (input_type& in) {
+    return in.size();
+  };
+  auto convert_reduce = [&] (input_type& in, result_type& dst) {
+    out.reduce_seq(in.lo, in.hi, dst);
+  };
+  auto seq_convert_reduce = convert_reduce;
+  level4::reduce(in, out, id, dst, convert_reduce_comp, convert_reduce, seq_convert_reduce);
+  return dst;
+}
+  
+/*---------------------------------------------------------------------*/
+/* Deterministic reduction and scan */
+
+/* The result of a reduction or a scan with a combining operator that
+ * is not exactly associative, such as floating-point addition, depends
+ * on the way the input is split, and the splits made by the granularity
+ * controller vary from run to run. The operations below split the input
+ * in blocks of fixed size and combine the results of the blocks by a
+ * tree whose shape depends only on the size of the input. As such, the
+ * result is the same from one run to the next, regardless of the
+ * granularity-control decisions and of the number of processors.
+ */
+
+namespace deterministic {
+
+#define DATAPAR_DETERMINISTIC_BLOCK_SIZE 2048
+
+namespace {
+  
+template <class Result>
+class identity_lift {
+public:
+  const Result& operator()(const Result& x) const {
+    return x;
+  }
+};
+
+template <
+  class Iter,
+  class Result,
+  class Combine,
+  class Lift
+>
+Result reduce_seq(Iter lo,
+                  Iter hi,
+                  const Result& id,
+                  const Combine& combine,
+                  const Lift& lift,
+                  bool backward) {
+  Result r = id;
+  if (backward) {
+    for (Iter it = hi; it != lo; ) {
+      it--;
+      r = combine(r, lift(*it));
+    }
+  } else {
+    for (Iter it = lo; it != hi; it++) {
+      r = combine(r, lift(*it));
+    }
+  }
+  return r;
+}
+
+// returns the reductions of the consecutive blocks of
+// DATAPAR_DETERMINISTIC_BLOCK_SIZE items in [lo, hi), each block
+// being reduced sequentially
+template <
+  class Iter,
+  class Result,
+  class Combine,
+  class Lift
+>
+parray<Result> reduce_blocks(Iter lo,
+                             Iter hi,
+                             const Result& id,
+                             const Combine& combine,
+                             const Lift& lift,
+                             bool backward) {
+  const long k = DATAPAR_DETERMINISTIC_BLOCK_SIZE;
+  long n = hi - lo;
+  long m = level4::get_nb_blocks(k, n);
+  parray<Result> partials;
+  partials.prefix_tabulate(m, 0);
+  auto reduce_block = [&] (long i) {
+    auto rng = level4::get_rng(k, n, i);
+    new (&partials[i]) Result(reduce_seq(lo + rng.first, lo + rng.second, id, combine, lift, backward));
+  };
+  range::parallel_for(0L, m, [&] (long l, long r) { return (r - l) * k; }, reduce_block, [&] (long l, long r) {
+    for (long i = l; i < r; i++) {
+      reduce_block(i);
+    }
+  });
+  return partials;
+}
+
+// returns the total of the items, combined in the order of the scan
+template <
+  class Iter,
+  class Output_iter,
+  class Result,
+  class Combine,
+  class Lift
+>
+Result scan_rec(Iter lo,
+                Iter hi,
+                Output_iter outs_lo,
+                const Result& id,
+                const Combine& combine,
+                const Lift& lift,
+                scan_type st) {
+  const long k = DATAPAR_DETERMINISTIC_BLOCK_SIZE;
+  using output_type = level3::cell_output<Result, Combine>;
+  output_type out(id, combine);
+  auto convert = [&] (reference_of<Iter> src, Result& dst) {
+    dst = lift(src);
+  };
+  long n = hi - lo;
+  if (n <= k) {
+    // the input and output ranges can overlap, so the total is taken first
+    Result total = reduce_seq(lo, hi, id, combine, lift, is_backward_scan(st));
+    if (n > 0) {
+      level4::scan_seq(lo, hi, outs_lo, out, id, convert, st);
+    }
+    return total;
+  }
+  long m = level4::get_nb_blocks(k, n);
+  parray<Result> partials = reduce_blocks(lo, hi, id, combine, lift, is_backward_scan(st));
+  auto st2 = (is_backward_scan(st)) ? backward_exclusive_scan : forward_exclusive_scan;
+  Result total = scan_rec(partials.cbegin(), partials.cend(), partials.begin(), id, combine, identity_lift<Result>(), st2);
+  auto scan_block = [&] (long i) {
+    auto rng = level4::get_rng(k, n, i);
+    level4::scan_seq(lo + rng.first, lo + rng.second, outs_lo + rng.first, out, partials[i], convert, st);
+  };
+  range::parallel_for(0L, m, [&] (long l, long r) { return (r - l) * k; }, scan_block, [&] (long l, long r) {
+    for (long i = l; i < r; i++) {
+      scan_block(i);
+    }
+  });
+  return total;
+}
+
+} // end namespace
+
+template <
+  class Iter,
+  class Result,
+  class Combine,
+  class Lift
+>
+Result reduce(Iter lo,
+              Iter hi,
+              Result id,
+              const Combine& combine,
+              const Lift& lift) {
+  const long k = DATAPAR_DETERMINISTIC_BLOCK_SIZE;
+  if (hi - lo <= k) {
+    return reduce_seq(lo, hi, id, combine, lift, false);
+  }
+  parray<Result> partials = reduce_blocks(lo, hi, id, combine, lift, false);
+  identity_lift<Result> lift2;
+  while (partials.size() > k) {
+    partials = reduce_blocks(partials.cbegin(), partials.cend(), id, combine, lift2, false);
+  }
+  return reduce_seq(partials.cbegin(), partials.cend(), id, combine, lift2, false);
+}
+
+template <class Iter, class Item, class Combine>
+Item reduce(Iter lo, Iter hi, Item id, const Combine& combine) {
+  return deterministic::reduce(lo, hi, id, combine, identity_lift<Item>());
+}
+
+template <class Iter>
+value_type_of<Iter> sum(Iter lo, Iter hi) {
+  using number = value_type_of<Iter>;
+  return reduce(lo, hi, (number)0, [&] (number x, number y) {
+    return x + y;
+  });
+}
+
+template <
+  class Iter,
+  class Result,
+  class Combine,
+  class Lift
+>
+parray<Result> scan(Iter lo,
+                    Iter hi,
+                    Result id,
+                    const Combine& combine,
+                    const Lift& lift,
+                    scan_type st) {
+  parray<Result> results;
+  results.prefix_tabulate(hi - lo, 0);
+  scan_rec(lo, hi, results.begin(), id, combine, lift, st);
+  return results;
+}
+
+template <class Iter, class Item, class Combine>
+parray<Item> scan(Iter lo, Iter hi, Item id, const Combine& combine, scan_type st) {
+  return deterministic::scan(lo, hi, id, combine, identity_lift<Item>(), st);
+}
+
+namespace dps {
+
+template <
+  class Input_iter,
+  class Output_iter,
+  class Item,
+  class Combine
+>
+Item scan(Input_iter lo,
+          Input_iter hi,
+          Item id,
+          const Combine& combine,
+          Output_iter outs_lo,
+          scan_type st) {
+  return scan_rec(lo, hi, outs_lo, id, combine, identity_lift<Item>(), st);
+}
+
+} // end namespace
+
+} // end namespace
+  
+/*---------------------------------------------------------------------*/
+/* Segmented reduction and scan */
+
+/* The segmented operations take a flat sequence of items [lo, hi)
+ * along with a sequence of m+1 nondecreasing offsets [offsets_lo,
+ * offsets_hi), such as the one returned by `weights`, and treat
+ * the positions [lo + offsets_lo[i], lo + offsets_lo[i+1]) as the
+ * i-th segment. All the segments are processed in a single pass that
+ * is split by the total number of items and segments, so that many
+ * small segments are handled sequentially at the leaves, without
+ * any per-segment fork or call to the granularity controller.
+ */
+
+namespace {
+
+template <
+  class Offsets_iter,
+  class Visit_segment,
+  class Seq_visit_segments
+>
+class segmented_for_contr {
+public:
+  static controller_type contr;
+};
+
+template <
+  class Offsets_iter,
+  class Visit_segment,
+  class Seq_visit_segments
+>
+controller_type segmented_for_contr<Offsets_iter,Visit_segment,Seq_visit_segments>::contr(
+  "segmented_for"+sota<Offsets_iter>()+sota<Visit_segment>()+sota<Seq_visit_segments>());
+
+// weight of the segments [0, i): one unit per item, plus one unit per segment
+template <class Offsets_iter>
+long segmented_weight(Offsets_iter offsets_lo, long i) {
+  return (offsets_lo[i] - offsets_lo[0]) + i;
+}
+
+template <
+  class Offsets_iter,
+  class Visit_segment,
+  class Seq_visit_segments
+>
+void segmented_for_rec(Offsets_iter offsets_lo,
+                       long lo,
+                       long hi,
+                       const Visit_segment& visit_segment,
+                       const Seq_visit_segments& seq_visit_segments) {
+  using controller_type = segmented_for_contr<Offsets_iter, Visit_segment, Seq_visit_segments>;
+  long comp = segmented_weight(offsets_lo, hi) - segmented_weight(offsets_lo, lo);
+#ifdef MANUAL_CONTROL
+  if (comp < DATAPAR_THRESHOLD) {
+    seq_visit_segments(lo, hi);
+    return;
+  }
+#endif
+  par::cstmt(controller_type::contr, [&] { return comp; }, [&] {
+    if (hi - lo <= 0) {
+      
+    } else if (hi - lo == 1) {
+      visit_segment(lo);
+    } else {
+      // split at the segment that holds the midpoint of the weight,
+      // the weight being strictly increasing in the segment index
+      long target = (segmented_weight(offsets_lo, lo) + segmented_weight(offsets_lo, hi)) / 2;
+      long l = lo + 1;
+      long h = hi - 1;
+      while (l < h) {
+        long m = l + (h - l) / 2;
+        if (segmented_weight(offsets_lo, m) < target) {
+          l = m + 1;
+        } else {
+          h = m;
+        }
+      }
+      long mid = l;
+      par::fork2([&] {
+        segmented_for_rec(offsets_lo, lo, mid, visit_segment, seq_visit_segments);
+      }, [&] {
+        segmented_for_rec(offsets_lo, mid, hi, visit_segment, seq_visit_segments);
+      });
+    }
+  }, [&] {
+    seq_visit_segments(lo, hi);
+  });
+}
+
+// calls `visit_segment(i)` on each segment i described by the
+// offsets, unless the segment gets grouped with its neighbours in a
+// call `seq_visit_segments(lo, hi)`
+template <
+  class Offsets_iter,
+  class Visit_segment,
+  class Seq_visit_segments
+>
+void segmented_for(Offsets_iter offsets_lo,
+                   Offsets_iter offsets_hi,
+                   const Visit_segment& visit_segment,
+                   const Seq_visit_segments& seq_visit_segments) {
+  long m = offsets_hi - offsets_lo - 1;
+  if (m < 1) {
+    return;
+  }
+  segmented_for_rec(offsets_lo, 0L, m, visit_segment, seq_visit_segments);
+}
+
+} // end namespace
+
+template <
+  class Iter,
+  class Offsets_iter,
+  class Result,
+  class Combine,
+  class Lift
+>
+parray<Result> segmented_reduce(Iter lo,
+                                Iter hi,
+                                Offsets_iter offsets_lo,
+                                Offsets_iter offsets_hi,
+                                Result id,
+                                const Combine& combine,
+                                const Lift& lift) {
+  parray<Result> results;
+  long m = std::max(0L, (long)(offsets_hi - offsets_lo) - 1);
+  // the slots are left uninitialized, and each one is constructed by
+  // the visit of its segment
+  results.prefix_tabulate(m, 0);
+  assert(m == 0 || offsets_lo[m] <= hi - lo);
+  auto seq_reduce_segment = [&] (long i) {
+    Result r = id;
+    for (Iter it = lo + offsets_lo[i]; it != lo + offsets_lo[i + 1]; it++) {
+      r = combine(r, lift(*it));
+    }
+    new (&results[i]) Result(std::move(r));
+  };
+  segmented_for(offsets_lo, offsets_hi, [&] (long i) {
+    new (&results[i]) Result(level1::reduce(lo + offsets_lo[i], lo + offsets_lo[i + 1], id, combine, lift));
+  }, [&] (long s_lo, long s_hi) {
+    for (long i = s_lo; i < s_hi; i++) {
+      seq_reduce_segment(i);
+    }
+  });
+  return results;
+}
+
+template <
+  class Iter,
+  class Offsets_iter,
+  class Item,
+  class Combine
+>
+parray<Item> segmented_reduce(Iter lo,
+                              Iter hi,
+                              Offsets_iter offsets_lo,
+                              Offsets_iter offsets_hi,
+                              Item id,
+                              const Combine& combine) {
+  auto lift = [&] (reference_of<Iter> x) {
+    return x;
+  };
+  return segmented_reduce(lo, hi, offsets_lo, offsets_hi, id, combine, lift);
+}
+
+namespace dps {
+
+template <
+  class Input_iter,
+  class Offsets_iter,
+  class Output_iter,
+  class Item,
+  class Combine
+>
+void segmented_scan(Input_iter lo,
+                    Input_iter hi,
+                    Offsets_iter offsets_lo,
+                    Offsets_iter offsets_hi,
+                    Item id,
+                    const Combine& combine,
+                    Output_iter outs_lo,
+                    scan_type st);
+
+} // end namespace
+
+/* Scans each segment independently; the result has one item per
+ * input item, that is, the same layout as the input sequence.
+ */
+template <
+  class Iter,
+  class Offsets_iter,
+  class Item,
+  class Combine
+>
+parray<Item> segmented_scan(Iter lo,
+                            Iter hi,
+                            Offsets_iter offsets_lo,
+                            Offsets_iter offsets_hi,
+                            Item id,
+                            const Combine& combine,
+                            scan_type st) {
+  parray<Item> results;
+  results.prefix_tabulate(hi - lo, 0);
+  dps::segmented_scan(lo, hi, offsets_lo, offsets_hi, id, combine, results.begin(), st);
+  return results;
+}
+  
+/***********************************************************************/
+
+namespace dps {
+  
+/*---------------------------------------------------------------------*/
+/* Reduction level 2 */
+  
+namespace level2 {
+
+template <
+  class Input_iter,
+  class Result,
+  class Output_iter,
+  class Combine,
+  class Lift_comp_rng,
+  class Lift_idx,
+  class Seq_scan_rng_dst
+  >
+void scan(Input_iter lo,
+          Input_iter hi,
+          Result& id,
+          const Combine& combine,
+          Output_iter outs_lo,
+          const Lift_comp_rng& lift_comp_rng,
+          const Lift_idx& lift_idx,
+          const Seq_scan_rng_dst& seq_scan_rng_dst,
+          scan_type st) {
+  using output_type = level3::cell_output<Result, Combine>;
+  output_type out(id, combine);
+  auto lift_idx_dst = [&] (long pos, reference_of<Input_iter> x, Result& dst) {
+    dst = lift_idx(pos, x);
+  };
+  level3::scan(lo, hi, out, id, outs_lo, lift_comp_rng, lift_idx_dst, seq_scan_rng_dst, st);
+}
+  
+} // end namespace
+  
+/*---------------------------------------------------------------------*/
+/* Reduction level 1 */
+  
+namespace level1 {
+  
+namespace {
+
+// runs `scan` on [lo, hi) and then returns the total of the items,
+// which is recovered from the scan results
+template <
+  class Input_iter,
+  class Result,
+  class Output_iter,
+  class Combine,
+  class Lift_idx,
+  class Scan
+>
+Result scan_total(Input_iter lo,
+                  Input_iter hi,
+                  Result& id,
+                  const Combine& combine,
+                  Output_iter outs_lo,
+                  const Lift_idx& lift_idx,
+                  const Scan& scan,
+                  scan_type st) {
+  if (lo >= hi) {
+    return id;
+  }
+  if (st == forward_inclusive_scan) {
+    scan();
+    return *(outs_lo + (hi - lo) - 1);
+  } else if (st == backward_inclusive_scan) {
+    scan();
+    return *outs_lo;
+  } else if (st == forward_exclusive_scan) {
+    // the input and output ranges can overlap
+    value_type_of<Input_iter> v = *(hi - 1);
+    scan();
+    return combine(*(outs_lo + (hi - lo) - 1), lift_idx(hi - lo - 1, v));
+  } else if (st == backward_exclusive_scan) {
+    value_type_of<Input_iter> v = *lo;
+    scan();
+    return combine(*outs_lo, lift_idx(0, v));
+  }
+  assert(false);
+  return id;
+}
+
+} // end namespace
+  
+template <
+  class Input_iter,
+  class Result,
+  class Output_iter,
+  class Combine,
+  class Lift_comp_idx,
+  class Lift_idx
+>
+Result scani(Input_iter lo,
+             Input_iter hi,
+             Result& id,
              const Combine& combine,
              Output_iter outs_lo,
              const Lift_comp_idx& lift_comp_idx,
              const Lift_idx& lift_idx,
              scan_type st) {
   parray<long> w = weights(hi-lo, [&] (long pos) {
-    return lift_comp_idx(pos, lo+pos);
+    return lift_comp_idx(pos, *(lo+pos));
   });
   auto lift_comp_rng = [&] (Input_iter _lo, Input_iter _hi) {
     long l = _lo - lo;
     long h = _hi - lo;
-    long wrng = w[l] - w[h];
+    long wrng = w[h] - w[l];
     return (long)(log(wrng) * wrng);
   };
   using output_type = level3::cell_output<Result, Combine>;
   output_type out(id, combine);
-  using iterator = typename parray<Result>::iterator;
-  auto seq_scan_rng_dst = [&] (Result _id, Input_iter _lo, Input_iter _hi, iterator outs_lo) {
-    level4::scan_seq(_lo, _hi, outs_lo, out, _id, [&] (reference_of<Input_iter> src, Result& dst) {
-      dst = src;
+  auto seq_scan_rng_dst = [&] (Result _id, Input_iter _lo, Input_iter _hi, Output_iter outs_lo) {
+    long pos = _lo - lo;
+    level4::scan_seq_idx(_lo, _hi, outs_lo, out, _id, [&] (long i, reference_of<Input_iter> src, Result& dst) {
+      dst = lift_idx(pos + i, src);
     }, st);
   };
-  level2::scan(lo, hi, id, combine, outs_lo, lift_comp_rng, lift_idx, seq_scan_rng_dst, st);
-  return total_of_exclusive_scan(lo, outs_lo, hi-lo, id, combine, lift_idx);
+  return scan_total(lo, hi, id, combine, outs_lo, lift_idx, [&] {
+    level2::scan(lo, hi, id, combine, outs_lo, lift_comp_rng, lift_idx, seq_scan_rng_dst, st);
+  }, st);
 }
   
 template <
@@ -1468,75 +2603,185 @@ Result scani(Input_iter lo,
   };
   using output_type = level3::cell_output<Result, Combine>;
   output_type out(id, combine);
-  using iterator = typename parray<Result>::iterator;
-  auto seq_scan_rng_dst = [&] (Result id, Input_iter lo, Input_iter hi, iterator outs_lo) {
-    level4::scan_seq(lo, hi, outs_lo, out, id, [&] (reference_of<Input_iter> src, Result& dst) {
-      dst = src;
+  auto seq_scan_rng_dst = [&] (Result _id, Input_iter _lo, Input_iter _hi, Output_iter outs_lo) {
+    long pos = _lo - lo;
+    level4::scan_seq_idx(_lo, _hi, outs_lo, out, _id, [&] (long i, reference_of<Input_iter> src, Result& dst) {
+      dst = lift_idx(pos + i, src);
     }, st);
   };
-  if (lo >= hi) {
-    return id;
-  }
-  if (st == forward_inclusive_scan) {
-    level2::scan(lo, hi, id, combine, outs_lo, lift_comp_rng, lift_idx, seq_scan_rng_dst, st);
-    return *(outs_lo + (hi - lo) - 1);
-  } else if (st == backward_inclusive_scan) {
-    level2::scan(lo, hi, id, combine, outs_lo, lift_comp_rng, lift_idx, seq_scan_rng_dst, st);
-    return *outs_lo;
-  } else if (st == forward_exclusive_scan) {
-    value_type_of<Input_iter> v = *(hi - 1);
-    level2::scan(lo, hi, id, combine, outs_lo, lift_comp_rng, lift_idx, seq_scan_rng_dst, st);
-    return combine(*(outs_lo + (hi - lo) - 1), lift_idx(hi - lo - 1, v));
-  } else if (st == backward_exclusive_scan) {
-    value_type_of<Input_iter> v = *lo;
+  return scan_total(lo, hi, id, combine, outs_lo, lift_idx, [&] {
     level2::scan(lo, hi, id, combine, outs_lo, lift_comp_rng, lift_idx, seq_scan_rng_dst, st);
-    return combine(*outs_lo, lift_idx(0, v));
-  }
-  assert(false);
+  }, st);
+}
+  
+template <
+  class Input_iter,
+  class Result,
+  class Output_iter,
+  class Combine,
+  class Lift
+>
+Result scan(Input_iter lo,
+            Input_iter hi,
+            Result& id,
+            const Combine& combine,
+            Output_iter outs_lo,
+            const Lift& lift,
+            scan_type st) {
+  auto lift_idx = [&] (long, reference_of<Input_iter> x) {
+    return lift(x);
+  };
+  return scani(lo, hi, id, combine, outs_lo, lift_idx, st);
+}
+  
+template <
+  class Iter,
+  class Result,
+  class Combine,
+  class Lift
+>
+void reduce(Iter lo,
+            Iter hi,
+            Result id,
+            const Combine& combine,
+            const Lift& lift,
+            Result& dst) {
+  using output_type = level3::cell_output<Result, Combine>;
+  output_type out(id, combine);
+  auto lift_comp_rng = [&] (Iter lo, Iter hi) {
+    return hi - lo;
+  };
+  auto lift_idx_dst = [&] (long, reference_of<Iter> x, Result& dst) {
+    dst = lift(x);
+  };
+  auto seq_reduce_rng_dst = [&] (Iter lo, Iter hi, Result& dst) {
+    dst = id;
+    for (Iter it = lo; it != hi; it++) {
+      dst = combine(std::move(dst), lift(*it));
+    }
+  };
+  level3::reduce(lo, hi, out, id, dst, lift_comp_rng, lift_idx_dst, seq_reduce_rng_dst);
 }
+  
 } // end namespace
+  
 /*---------------------------------------------------------------------*/
 /* Reduction level 0 */
 
 template <
   class Iter,
   class Item,
+  class Combine
+>
+void reduce(Iter lo,
+            Iter hi,
+            Item id,
+            const Combine& combine,
+            Item& dst) {
+  auto lift = [&] (reference_of<Iter> x) {
+    return x;
+  };
+  level1::reduce(lo, hi, id, combine, lift, dst);
+}
+
+/*---------------------------------------------------------------------*/
+/* Max index */
+
+template <
+  class Iter,
+  class Item,
+  class Comp,
+  class Lift
+>
+void max_index(Iter lo,
+               Iter hi,
+               const Item& id,
+               const Comp& comp,
+               const Lift& lift,
+               long& dst) {
+  dst = pasl::pctl::max_index(lo, hi, id, comp, lift);
+}
+
+template <
+  class Iter,
+  class Item,
+  class Comp
+>
+void max_index(Iter lo,
+               Iter hi,
+               const Item& id,
+               const Comp& comp,
+               long& dst) {
+  dst = pasl::pctl::max_index(lo, hi, id, comp);
+}
+
+template <
+  class Input_iter,
+  class Item,
   class Combine,
+  class Output_iter,
   class Weight
 >
-Item scan(Iter lo,
-          Iter hi,
+Item scan(Input_iter lo,
+          Input_iter hi,
           Item id,
           const Combine& combine,
-          Iter outs_lo,
+          Output_iter outs_lo,
           const Weight& weight,
           scan_type st) {
-  auto lift_idx = [&] (long, reference_of<Iter> x) {
+  auto lift_idx = [&] (long, reference_of<Input_iter> x) {
     return x;
   };
-  auto lift_comp_idx = [&] (long, reference_of<Iter>x ) {
+  auto lift_comp_idx = [&] (long, reference_of<Input_iter> x) {
     return weight(x);
   };
   return level1::scani(lo, hi, id, combine, outs_lo, lift_comp_idx, lift_idx, st);
 }
   
 template <
-  class Iter,
+  class Input_iter,
   class Item,
-  class Combine
+  class Combine,
+  class Output_iter
 >
-Item scan(Iter lo,
-          Iter hi,
+Item scan(Input_iter lo,
+          Input_iter hi,
           Item id,
           const Combine& combine,
-          Iter outs_lo,
+          Output_iter outs_lo,
           scan_type st) {
-  auto lift_idx = [&] (long, reference_of<Iter> x) {
+  auto lift_idx = [&] (long, reference_of<Input_iter> x) {
     return x;
   };
   return level1::scani(lo, hi, id, combine, outs_lo, lift_idx, st);
 }
   
+/*---------------------------------------------------------------------*/
+/* Tabulate and map */
+
+template <class Output_iter, class Body>
+void tabulate(Output_iter outs_lo, Output_iter outs_hi, const Body& body) {
+  long n = outs_hi - outs_lo;
+  range::parallel_for(0L, n, [&] (long l, long r) { return r - l; }, [&] (long i) {
+    *(outs_lo + i) = body(i);
+  }, [&] (long l, long r) {
+    for (long i = l; i < r; i++) {
+      *(outs_lo + i) = body(i);
+    }
+  });
+}
+  
+template <
+  class Input_iter,
+  class Output_iter,
+  class Fct
+>
+void map(Input_iter lo, Input_iter hi, Output_iter outs_lo, const Fct& f) {
+  tabulate(outs_lo, outs_lo + (hi - lo), [&] (long i) {
+    return f(*(lo + i));
+  });
+}
+  
 /*---------------------------------------------------------------------*/
 /* Pack and filter */
   
@@ -1553,6 +2798,16 @@ long pack(Flags_iter flags_lo, Input_iter lo, Input_iter hi, Output_iter dst_lo)
   });
 }
 
+template <class Flags_iter, class Output_iter>
+long pack_index(Flags_iter lo, Flags_iter hi, Output_iter dst_lo) {
+  long dummy;
+  return __priv::pack(lo, lo, hi, dummy, [&] (long) {
+    return dst_lo;
+  }, [&] (long offset, reference_of<Flags_iter>) {
+    return offset;
+  });
+}
+
 template <
   class Input_iter,
   class Output_iter,
@@ -1596,6 +2851,91 @@ long filter_seq(Input_iter lo, Input_iter hi, Output_iter dst_lo, const Pred& pr
   return total;
 }
   
+/*---------------------------------------------------------------------*/
+/* Unique and adjacent difference */
+  
+template <
+  class Input_iter,
+  class Output_iter,
+  class Equal
+>
+long unique(Input_iter lo, Input_iter hi, Output_iter dst_lo, const Equal& equal) {
+  return __priv::pack_if(hi - lo, [&] (long i) {
+    return i == 0 || ! equal(lo[i - 1], lo[i]);
+  }, [&] (long) {
+    return dst_lo;
+  }, [&] (long i) {
+    return lo[i];
+  });
+}
+  
+template <class Input_iter, class Output_iter>
+long unique(Input_iter lo, Input_iter hi, Output_iter dst_lo) {
+  return dps::unique(lo, hi, dst_lo, std::equal_to<value_type_of<Input_iter>>());
+}
+  
+template <
+  class Input_iter,
+  class Output_iter,
+  class Difference
+>
+void adjacent_difference(Input_iter lo, Input_iter hi, Output_iter dst_lo, const Difference& difference) {
+  tabulate(dst_lo, dst_lo + (hi - lo), [&] (long i) {
+    return (i == 0) ? lo[0] : difference(lo[i], lo[i - 1]);
+  });
+}
+  
+template <class Input_iter, class Output_iter>
+void adjacent_difference(Input_iter lo, Input_iter hi, Output_iter dst_lo) {
+  using value_type = value_type_of<Input_iter>;
+  dps::adjacent_difference(lo, hi, dst_lo, [&] (const value_type& x, const value_type& y) {
+    return x - y;
+  });
+}
+  
+/*---------------------------------------------------------------------*/
+/* Segmented scan */
+
+template <
+  class Input_iter,
+  class Offsets_iter,
+  class Output_iter,
+  class Item,
+  class Combine
+>
+void segmented_scan(Input_iter lo,
+                    Input_iter hi,
+                    Offsets_iter offsets_lo,
+                    Offsets_iter offsets_hi,
+                    Item id,
+                    const Combine& combine,
+                    Output_iter outs_lo,
+                    scan_type st) {
+  assert(offsets_hi == offsets_lo || offsets_hi[-1] <= hi - lo);
+  using output_type = level3::cell_output<Item, Combine>;
+  output_type out(id, combine);
+  auto seq_scan_segment = [&] (long i) {
+    if (offsets_lo[i] == offsets_lo[i + 1]) {
+      return;
+    }
+    level4::scan_seq(lo + offsets_lo[i], lo + offsets_lo[i + 1], outs_lo + offsets_lo[i], out, id, [&] (reference_of<Input_iter> src, Item& dst) {
+      dst = src;
+    }, st);
+  };
+  auto lift_idx = [&] (long, reference_of<Input_iter> x) {
+    return x;
+  };
+  segmented_for(offsets_lo, offsets_hi, [&] (long i) {
+    Input_iter s_lo = lo + offsets_lo[i];
+    Input_iter s_hi = lo + offsets_lo[i + 1];
+    level1::scani(s_lo, s_hi, id, combine, outs_lo + offsets_lo[i], lift_idx, st);
+  }, [&] (long s_lo, long s_hi) {
+    for (long i = s_lo; i < s_hi; i++) {
+      seq_scan_segment(i);
+    }
+  });
+}
+  
 } // end namespace dps
 } // end namespace
 } // end namespace
@@ -670,8 +670,10 @@ void cstmt_parallel(execmode_type c, const Body_fct& body_fct) {
   execmode.mine().block(c, body_fct);
 }
 
+// `completed` is read after the body has run; the work is reported to
+// the estimator only if it holds
 template <class Body_fct>
-void cstmt_unknown(execmode_type c, complexity_type m, Body_fct& body_fct, estimator& estimator) {
+void cstmt_unknown(execmode_type c, complexity_type m, Body_fct& body_fct, estimator& estimator, const bool& completed) {
   cost_type upper_work = work.mine() + since_in_cycles(timer.mine());
 #ifdef PLOGGING
     pasl::pctl::logging::log(pasl::pctl::logging::PARALLEL_RUN_START, estimator.name.c_str(), m, work.mine() / estimator::local_ticks_per_microsecond);
@@ -685,7 +687,9 @@ void cstmt_unknown(execmode_type c, complexity_type m, Body_fct& body_fct, estim
 
   work.mine() += since_in_cycles(timer.mine());
 
-  estimator.report(std::max((complexity_type) 1, m), work.mine(), estimator.is_undefined());
+  if (completed) {
+    estimator.report(std::max((complexity_type) 1, m), work.mine(), estimator.is_undefined());
+  }
 #ifdef PLOGGING
     pasl::pctl::logging::log(pasl::pctl::logging::PARALLEL_RUN, estimator.name.c_str(), m, work.mine() / estimator::local_ticks_per_microsecond);
 #endif
@@ -694,18 +698,33 @@ void cstmt_unknown(execmode_type c, complexity_type m, Body_fct& body_fct, estim
   timer.mine() = get_wall_time();
 }
 
+template <class Body_fct>
+void cstmt_unknown(execmode_type c, complexity_type m, Body_fct& body_fct, estimator& estimator) {
+  cstmt_unknown(c, m, body_fct, estimator, true);
+}
+
 template <class Seq_body_fct>
 void cstmt_sequential_with_reporting(complexity_type m,
                                      const Seq_body_fct& seq_body_fct,
-                                     estimator& estimator) {
+                                     estimator& estimator,
+                                     const bool& completed) {
   cost_type start = now();
   execmode.mine().block(Sequential, seq_body_fct);
   cost_type elapsed = since(start);
-  estimator.report(std::max((complexity_type)1, m), elapsed);
+  if (completed) {
+    estimator.report(std::max((complexity_type)1, m), elapsed);
+  }
 #ifdef PLOGGING
     pasl::pctl::logging::log(pasl::pctl::logging::SEQUENTIAL_RUN, estimator.name.c_str(), m, elapsed / estimator::local_ticks_per_microsecond);
 #endif
 }
+
+template <class Seq_body_fct>
+void cstmt_sequential_with_reporting(complexity_type m,
+                                     const Seq_body_fct& seq_body_fct,
+                                     estimator& estimator) {
+  cstmt_sequential_with_reporting(m, seq_body_fct, estimator, true);
+}
   
 template <
 class Complexity_measure_fct,
@@ -809,15 +828,18 @@ void cstmt(control_by_prediction& contr,
   }
 }
 
+// `completed` is read after the chosen body has run; the work is
+// reported to the estimator only if it holds
 template <
 class Complexity_measure_fct,
 class Par_body_fct,
 class Seq_body_fct
 >
-void cstmt(control_by_prediction& contr,
-           const Complexity_measure_fct& complexity_measure_fct,
-           const Par_body_fct& par_body_fct,
-           const Seq_body_fct& seq_body_fct) {
+void cstmt_by_prediction(control_by_prediction& contr,
+                         const Complexity_measure_fct& complexity_measure_fct,
+                         const Par_body_fct& par_body_fct,
+                         const Seq_body_fct& seq_body_fct,
+                         const bool& completed) {
 #if defined(PLOGGING) || defined(THREADS_CREATED)
   calls_number.mine()++;
 #endif
@@ -860,12 +882,24 @@ void cstmt(control_by_prediction& contr,
   }
   c = execmode_combine(my_execmode(), c);
   if (c == Sequential) {
-    cstmt_sequential_with_reporting(m, seq_body_fct, estimator);
+    cstmt_sequential_with_reporting(m, seq_body_fct, estimator, completed);
   } else {
-    cstmt_unknown(c, m, par_body_fct, estimator);
+    cstmt_unknown(c, m, par_body_fct, estimator, completed);
   }
 }
 
+template <
+class Complexity_measure_fct,
+class Par_body_fct,
+class Seq_body_fct
+>
+void cstmt(control_by_prediction& contr,
+           const Complexity_measure_fct& complexity_measure_fct,
+           const Par_body_fct& par_body_fct,
+           const Seq_body_fct& seq_body_fct) {
+  cstmt_by_prediction(contr, complexity_measure_fct, par_body_fct, seq_body_fct, true);
+}
+
 template <
 class Complexity_measure_fct,
 class Par_body_fct
@@ -876,6 +910,68 @@ void cstmt(control_by_prediction& contr,
   cstmt(contr, complexity_measure_fct, par_body_fct, par_body_fct);
 }
 
+/*---------------------------------------------------------------------*/
+/* Controlled statements that may give up early */
+
+/* Same as cstmt, but for bodies that may stop before doing all of the
+ * work announced by their complexity measure, such as the leaves of an
+ * early-exit search. Both bodies return true if they ran to completion,
+ * and so does the statement. A run that gave up early takes less time
+ * than its complexity predicts, so it is not reported to the estimator.
+ */
+
+template <
+class Complexity_measure_fct,
+class Par_body_fct,
+class Seq_body_fct
+>
+bool cstmt_early_exit(control_by_force_parallel&,
+                      const Complexity_measure_fct&,
+                      const Par_body_fct& par_body_fct,
+                      const Seq_body_fct&) {
+  bool completed = true;
+  cstmt_parallel(Force_parallel, [&] {
+    completed = par_body_fct();
+  });
+  return completed;
+}
+
+template <
+class Complexity_measure_fct,
+class Par_body_fct,
+class Seq_body_fct
+>
+bool cstmt_early_exit(control_by_force_sequential&,
+                      const Complexity_measure_fct&,
+                      const Par_body_fct&,
+                      const Seq_body_fct& seq_body_fct) {
+  bool completed = true;
+  cstmt_sequential(Force_sequential, [&] {
+    completed = seq_body_fct();
+  });
+  return completed;
+}
+
+template <
+class Complexity_measure_fct,
+class Par_body_fct,
+class Seq_body_fct
+>
+bool cstmt_early_exit(control_by_prediction& contr,
+                      const Complexity_measure_fct& complexity_measure_fct,
+                      const Par_body_fct& par_body_fct,
+                      const Seq_body_fct& seq_body_fct) {
+  bool completed = true;
+  auto par_body = [&] {
+    completed = par_body_fct();
+  };
+  auto seq_body = [&] {
+    completed = seq_body_fct();
+  };
+  cstmt_by_prediction(contr, complexity_measure_fct, par_body, seq_body, completed);
+  return completed;
+}
+
 // same as above but accepts all arguments to support general case
 /*template <
 class Cutoff_fct,
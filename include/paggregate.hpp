@@ -0,0 +1,544 @@
+/* COPYRIGHT (c) 2015 Umut Acar, Arthur Chargueraud, and Michael
+ * Rainey
+ * All rights reserved.
+ *
+ * \file paggregate.hpp
+ * \brief Keyed aggregation
+ *
+ */
+
+#include <functional>
+#include <type_traits>
+#include <vector>
+
+#include "pchunkedseq.hpp"
+#include "psort.hpp"
+#include "pmap.hpp"
+
+#ifndef _PCTL_PAGGREGATE_H_
+#define _PCTL_PAGGREGATE_H_
+
+namespace pasl {
+namespace pctl {
+
+/***********************************************************************/
+
+/*---------------------------------------------------------------------*/
+/* Reduce by key and group by */
+
+namespace {
+
+template <class Key, class Compare>
+bool same_key(const Key& x, const Key& y, const Compare& compare) {
+  return (! compare(x, y)) && (! compare(y, x));
+}
+
+// returns the offsets of the runs of keys that are equal by `equal` in
+// the sequence of keys denoted by `key_of`, along with a final
+// sentinel offset `n`
+template <class Key_of, class Equal>
+parray<long> key_run_offsets(long n, const Key_of& key_of, const Equal& equal) {
+  parray<bool> flags(n, [&] (long i) {
+    return (i == 0) || (! equal(key_of(i - 1), key_of(i)));
+  });
+  parray<long> starts = pack_index(flags.cbegin(), flags.cend());
+  long m = starts.size();
+  parray<long> offsets(m + 1, [&] (long i) {
+    return (i == m) ? n : starts[i];
+  });
+  return offsets;
+}
+
+// calls `visit_run(i, lo, hi)` for the i-th run [lo, hi) in
+// `offsets`, grouping small runs at the leaves of the loop
+template <class Visit_run, class Seq_visit_run>
+void for_each_key_run(const parray<long>& offsets,
+                      const Visit_run& visit_run,
+                      const Seq_visit_run& seq_visit_run) {
+  segmented_for(offsets.cbegin(), offsets.cend(), [&] (long i) {
+    visit_run(i, offsets[i], offsets[i + 1]);
+  }, [&] (long lo, long hi) {
+    for (long i = lo; i < hi; i++) {
+      seq_visit_run(i, offsets[i], offsets[i + 1]);
+    }
+  });
+}
+
+// reduces the values of each run of equal keys in [keys_lo, keys_hi)
+template <
+  class Key_iter,
+  class Value_iter,
+  class Value,
+  class Combine,
+  class Equal
+>
+parray<std::pair<value_type_of<Key_iter>, Value>> reduce_key_runs(Key_iter keys_lo,
+                                                                  Key_iter keys_hi,
+                                                                  Value_iter values_lo,
+                                                                  const Value& id,
+                                                                  const Combine& combine,
+                                                                  const Equal& equal) {
+  using value_type = std::pair<value_type_of<Key_iter>, Value>;
+  parray<value_type> result;
+  long n = keys_hi - keys_lo;
+  if (n < 1) {
+    return result;
+  }
+  parray<long> offsets = key_run_offsets(n, [&] (long i) -> reference_of<Key_iter> {
+    return *(keys_lo + i);
+  }, equal);
+  long m = offsets.size() - 1;
+  result.prefix_tabulate(m, 0);
+  for_each_key_run(offsets, [&] (long i, long lo, long hi) {
+    Value v = level1::reduce(values_lo + lo, values_lo + hi, id, combine, [&] (reference_of<Value_iter> x) {
+      return x;
+    });
+    new (&result[i]) value_type(*(keys_lo + lo), v);
+  }, [&] (long i, long lo, long hi) {
+    Value v = id;
+    for (long j = lo; j < hi; j++) {
+      v = combine(v, *(values_lo + j));
+    }
+    new (&result[i]) value_type(*(keys_lo + lo), v);
+  });
+  return result;
+}
+
+// collects the values of each run of equal keys in [keys_lo, keys_hi)
+template <class Key_iter, class Value_iter, class Equal>
+parray<std::pair<value_type_of<Key_iter>, parray<value_type_of<Value_iter>>>>
+group_key_runs(Key_iter keys_lo, Key_iter keys_hi, Value_iter values_lo, const Equal& equal) {
+  using group_type = parray<value_type_of<Value_iter>>;
+  using value_type = std::pair<value_type_of<Key_iter>, group_type>;
+  parray<value_type> result;
+  long n = keys_hi - keys_lo;
+  if (n < 1) {
+    return result;
+  }
+  parray<long> offsets = key_run_offsets(n, [&] (long i) -> reference_of<Key_iter> {
+    return *(keys_lo + i);
+  }, equal);
+  long m = offsets.size() - 1;
+  result.prefix_tabulate(m, 0);
+  auto visit_run = [&] (long i, long lo, long hi) {
+    new (&result[i]) value_type(*(keys_lo + lo), group_type(hi - lo, [&] (long j) {
+      return *(values_lo + lo + j);
+    }));
+  };
+  for_each_key_run(offsets, visit_run, visit_run);
+  return result;
+}
+
+/* Copies the keys and the values into `keys` and `values`, sorted by
+ * key. Only the keys and their indices are moved by the sort, and
+ * each value is then moved once, as by `sort_by_key`.
+ */
+template <class Key_iter, class Value_iter, class Compare>
+void sorted_copy_by_key(Key_iter keys_lo,
+                        Key_iter keys_hi,
+                        Value_iter values_lo,
+                        const Compare& compare,
+                        parray<value_type_of<Key_iter>>& keys,
+                        parray<value_type_of<Value_iter>>& values) {
+  long n = keys_hi - keys_lo;
+  keys.tabulate(n, [&] (long i) {
+    return *(keys_lo + i);
+  });
+  values.tabulate(n, [&] (long i) {
+    return *(values_lo + i);
+  });
+  sort_by_key(keys.begin(), keys.end(), compare, values.begin());
+}
+
+/* Copies the keys and the values into `keys` and `values`, so that
+ * equal keys are stored in contiguous positions. The copies are radix
+ * sorted by the hashes of the keys, which leaves equal keys in the
+ * same run of equal hashes. Only the runs in which two keys collide
+ * are then regrouped by `equal`, sequentially.
+ */
+template <class Key_iter, class Value_iter, class Hash, class Equal>
+void semisorted_copy_by_key(Key_iter keys_lo,
+                            Key_iter keys_hi,
+                            Value_iter values_lo,
+                            const Hash& hash,
+                            const Equal& equal,
+                            parray<value_type_of<Key_iter>>& keys,
+                            parray<value_type_of<Value_iter>>& values) {
+  long n = keys_hi - keys_lo;
+  keys.tabulate(n, [&] (long i) {
+    return *(keys_lo + i);
+  });
+  values.tabulate(n, [&] (long i) {
+    return *(values_lo + i);
+  });
+  if (n < 2) {
+    return;
+  }
+  parray<std::size_t> hashes(n, [&] (long i) {
+    return (std::size_t)hash(keys[i]);
+  });
+  radix_sort_by_key(hashes.begin(), hashes.end(), keys.begin(), values.begin());
+  parray<long> offsets = key_run_offsets(n, [&] (long i) {
+    return hashes[i];
+  }, std::equal_to<std::size_t>());
+  auto regroup = [&] (long lo, long hi) {
+    for (long i = lo; i < hi; ) {
+      long j = i + 1;
+      for (long k = i + 1; k < hi; k++) {
+        if (equal(keys[k], keys[i])) {
+          std::swap(keys[j], keys[k]);
+          std::swap(values[j], values[k]);
+          j++;
+        }
+      }
+      i = j;
+    }
+  };
+  for_each_key_run(offsets, [&] (long, long lo, long hi) {
+    auto first = keys.cbegin() + lo;
+    auto collision = pasl::pctl::find_if(first + 1, keys.cbegin() + hi, [&] (const value_type_of<Key_iter>& k) {
+      return ! equal(k, *first);
+    });
+    if (collision != keys.cbegin() + hi) {
+      regroup(lo, hi);
+    }
+  }, [&] (long, long lo, long hi) {
+    regroup(lo, hi);
+  });
+}
+
+} // end namespace
+
+/* Combines, for each distinct key, the values that are associated
+ * with that key. The keys in [keys_lo, keys_hi) must already be
+ * sorted with respect to `compare` (in fact, it is enough that equal
+ * keys are stored in contiguous positions). The result is ordered
+ * in the same way as the input keys.
+ */
+template <
+  class Key_iter,
+  class Value_iter,
+  class Value,
+  class Combine,
+  class Compare
+>
+parray<std::pair<value_type_of<Key_iter>, Value>>
+sorted_reduce_by_key(Key_iter keys_lo,
+                     Key_iter keys_hi,
+                     Value_iter values_lo,
+                     Value id,
+                     const Combine& combine,
+                     const Compare& compare) {
+  using key_type = value_type_of<Key_iter>;
+  return reduce_key_runs(keys_lo, keys_hi, values_lo, id, combine, [&] (const key_type& x, const key_type& y) {
+    return same_key(x, y, compare);
+  });
+}
+
+template <
+  class Key_iter,
+  class Value_iter,
+  class Value,
+  class Combine
+>
+parray<std::pair<value_type_of<Key_iter>, Value>>
+sorted_reduce_by_key(Key_iter keys_lo,
+                     Key_iter keys_hi,
+                     Value_iter values_lo,
+                     Value id,
+                     const Combine& combine) {
+  std::less<value_type_of<Key_iter>> compare;
+  return sorted_reduce_by_key(keys_lo, keys_hi, values_lo, id, combine, compare);
+}
+
+/* Same as above, but for keys stored in any order. The result is
+ * sorted by key.
+ */
+template <
+  class Key_iter,
+  class Value_iter,
+  class Value,
+  class Combine,
+  class Compare
+>
+parray<std::pair<value_type_of<Key_iter>, Value>>
+reduce_by_key(Key_iter keys_lo,
+              Key_iter keys_hi,
+              Value_iter values_lo,
+              Value id,
+              const Combine& combine,
+              const Compare& compare) {
+  parray<value_type_of<Key_iter>> keys;
+  parray<value_type_of<Value_iter>> values;
+  sorted_copy_by_key(keys_lo, keys_hi, values_lo, compare, keys, values);
+  return sorted_reduce_by_key(keys.cbegin(), keys.cend(), values.cbegin(), id, combine, compare);
+}
+
+template <
+  class Key_iter,
+  class Value_iter,
+  class Value,
+  class Combine
+>
+parray<std::pair<value_type_of<Key_iter>, Value>>
+reduce_by_key(Key_iter keys_lo,
+              Key_iter keys_hi,
+              Value_iter values_lo,
+              Value id,
+              const Combine& combine) {
+  std::less<value_type_of<Key_iter>> compare;
+  return reduce_by_key(keys_lo, keys_hi, values_lo, id, combine, compare);
+}
+
+/* Same as `reduce_by_key`, but groups the keys by their hashes rather
+ * than by sorting them: the keys need no ordering, only a hash
+ * function and an equality test. The result is ordered by hash.
+ */
+template <
+  class Key_iter,
+  class Value_iter,
+  class Value,
+  class Combine,
+  class Hash = std::hash<value_type_of<Key_iter>>,
+  class Equal = std::equal_to<value_type_of<Key_iter>>
+>
+parray<std::pair<value_type_of<Key_iter>, Value>>
+hash_reduce_by_key(Key_iter keys_lo,
+                   Key_iter keys_hi,
+                   Value_iter values_lo,
+                   Value id,
+                   const Combine& combine,
+                   const Hash& hash = Hash(),
+                   const Equal& equal = Equal()) {
+  parray<value_type_of<Key_iter>> keys;
+  parray<value_type_of<Value_iter>> values;
+  semisorted_copy_by_key(keys_lo, keys_hi, values_lo, hash, equal, keys, values);
+  return reduce_key_runs(keys.cbegin(), keys.cend(), values.cbegin(), id, combine, equal);
+}
+
+/* Same as `reduce_by_key`, but stores the result in a parallel map */
+template <
+  class Key_iter,
+  class Value_iter,
+  class Value,
+  class Combine,
+  class Compare = std::less<value_type_of<Key_iter>>
+>
+pmap<value_type_of<Key_iter>, Value, Compare>
+reduce_by_key_map(Key_iter keys_lo,
+                  Key_iter keys_hi,
+                  Value_iter values_lo,
+                  Value id,
+                  const Combine& combine,
+                  const Compare& compare = Compare()) {
+  auto kvs = reduce_by_key(keys_lo, keys_hi, values_lo, id, combine, compare);
+  pmap<value_type_of<Key_iter>, Value, Compare> result(kvs.size(), [&] (long i) {
+    return kvs[i];
+  });
+  return result;
+}
+
+/* Collects, for each distinct key, the values that are associated
+ * with that key. The result is sorted by key. The order of the values
+ * in each group is unspecified.
+ */
+template <
+  class Key_iter,
+  class Value_iter,
+  class Compare
+>
+parray<std::pair<value_type_of<Key_iter>, parray<value_type_of<Value_iter>>>>
+group_by(Key_iter keys_lo,
+         Key_iter keys_hi,
+         Value_iter values_lo,
+         const Compare& compare) {
+  using key_type = value_type_of<Key_iter>;
+  parray<key_type> keys;
+  parray<value_type_of<Value_iter>> values;
+  sorted_copy_by_key(keys_lo, keys_hi, values_lo, compare, keys, values);
+  return group_key_runs(keys.cbegin(), keys.cend(), values.cbegin(), [&] (const key_type& x, const key_type& y) {
+    return same_key(x, y, compare);
+  });
+}
+
+template <class Key_iter, class Value_iter>
+parray<std::pair<value_type_of<Key_iter>, parray<value_type_of<Value_iter>>>>
+group_by(Key_iter keys_lo, Key_iter keys_hi, Value_iter values_lo) {
+  std::less<value_type_of<Key_iter>> compare;
+  return group_by(keys_lo, keys_hi, values_lo, compare);
+}
+
+/* Same as `group_by`, but groups the keys by their hashes, as does
+ * `hash_reduce_by_key`. The result is ordered by hash.
+ */
+template <
+  class Key_iter,
+  class Value_iter,
+  class Hash = std::hash<value_type_of<Key_iter>>,
+  class Equal = std::equal_to<value_type_of<Key_iter>>
+>
+parray<std::pair<value_type_of<Key_iter>, parray<value_type_of<Value_iter>>>>
+hash_group_by(Key_iter keys_lo,
+              Key_iter keys_hi,
+              Value_iter values_lo,
+              const Hash& hash = Hash(),
+              const Equal& equal = Equal()) {
+  parray<value_type_of<Key_iter>> keys;
+  parray<value_type_of<Value_iter>> values;
+  semisorted_copy_by_key(keys_lo, keys_hi, values_lo, hash, equal, keys, values);
+  return group_key_runs(keys.cbegin(), keys.cend(), values.cbegin(), equal);
+}
+
+/*---------------------------------------------------------------------*/
+/* Histogram */
+
+namespace {
+
+template <class Weight>
+class histogram_bins {
+public:
+  
+  using bins_type = perworker::array<parray<Weight>*, perworker::get_my_id>;
+  
+  long nb_bins;
+  bins_type bins;
+  
+  histogram_bins(long nb_bins)
+  : nb_bins(nb_bins), bins(nullptr) { }
+  
+  ~histogram_bins() {
+    bins.iterate([&] (parray<Weight>*& b) {
+      if (b != nullptr) {
+        delete b;
+        b = nullptr;
+      }
+    });
+  }
+  
+  // bins of the calling worker, allocated on first use
+  parray<Weight>& mine() {
+    parray<Weight>*& b = bins.mine();
+    if (b == nullptr) {
+      b = new parray<Weight>(nb_bins, Weight());
+    }
+    return *b;
+  }
+  
+};
+
+template <
+  class Iter,
+  class Weight,
+  class Bin_of,
+  class Weight_of
+>
+parray<Weight> histogram_perworker(Iter lo,
+                                   Iter hi,
+                                   long nb_bins,
+                                   const Bin_of& bin_of,
+                                   const Weight_of& weight_of) {
+  histogram_bins<Weight> bins(nb_bins);
+  auto comp_rng = [&] (Iter lo, Iter hi) {
+    return hi - lo;
+  };
+  auto seq_body_rng = [&] (Iter lo, Iter hi) {
+    parray<Weight>& b = bins.mine();
+    for (Iter it = lo; it != hi; it++) {
+      b[bin_of(*it)] += weight_of(*it);
+    }
+  };
+  range::parallel_for(lo, hi, comp_rng, [&] (Iter it) {
+    seq_body_rng(it, it + 1);
+  }, seq_body_rng);
+  // only the workers that took part in the count contribute bins
+  std::vector<const parray<Weight>*> used;
+  bins.bins.iterate([&] (parray<Weight>* b) {
+    if (b != nullptr) {
+      used.push_back(b);
+    }
+  });
+  long nb_used = used.size();
+  parray<Weight> result(nb_bins, [&] (long i) {
+    Weight w = Weight();
+    for (long j = 0; j < nb_used; j++) {
+      w += (*used[j])[i];
+    }
+    return w;
+  });
+  return result;
+}
+
+template <
+  class Iter,
+  class Weight,
+  class Bin_of,
+  class Weight_of
+>
+parray<Weight> histogram_by_sort(Iter lo,
+                                 Iter hi,
+                                 long nb_bins,
+                                 const Bin_of& bin_of,
+                                 const Weight_of& weight_of) {
+  long n = hi - lo;
+  parray<long> keys(n, [&] (long i) {
+    return (long)bin_of(*(lo + i));
+  });
+  parray<Weight> ws(n, [&] (long i) {
+    return weight_of(*(lo + i));
+  });
+  auto kvs = reduce_by_key(keys.cbegin(), keys.cend(), ws.cbegin(), Weight(), [&] (Weight x, Weight y) {
+    return x + y;
+  });
+  parray<Weight> result(nb_bins, Weight());
+  parallel_for(0L, kvs.size(), [&] (long i) {
+    result[kvs[i].first] = kvs[i].second;
+  });
+  return result;
+}
+
+} // end namespace
+
+/* Returns, for each bin b in [0, nb_bins), the sum of `weight_of(x)`
+ * over the items x in [lo, hi) for which `bin_of(x) == b`.
+ *
+ * When there are few bins relative to the number of items, each
+ * worker counts into its own private bins, which are summed at the
+ * end. Otherwise, the cost of summing the private bins would dominate,
+ * and the items are instead grouped by sorting on the bin.
+ */
+template <
+  class Iter,
+  class Bin_of,
+  class Weight_of
+>
+auto weighted_histogram(Iter lo,
+                        Iter hi,
+                        long nb_bins,
+                        const Bin_of& bin_of,
+                        const Weight_of& weight_of)
+  -> parray<typename std::decay<decltype(weight_of(*lo))>::type> {
+  using weight_type = typename std::decay<decltype(weight_of(*lo))>::type;
+  long n = hi - lo;
+  if (nb_bins * par::nb_proc <= n) {
+    return histogram_perworker<Iter, weight_type>(lo, hi, nb_bins, bin_of, weight_of);
+  } else {
+    return histogram_by_sort<Iter, weight_type>(lo, hi, nb_bins, bin_of, weight_of);
+  }
+}
+
+/* Returns, for each bin b in [0, nb_bins), the number of items x in
+ * [lo, hi) for which `bin_of(x) == b`.
+ */
+template <class Iter, class Bin_of>
+parray<long> histogram(Iter lo, Iter hi, long nb_bins, const Bin_of& bin_of) {
+  return weighted_histogram(lo, hi, nb_bins, bin_of, [&] (reference_of<Iter>) {
+    return 1L;
+  });
+}
+
+/***********************************************************************/
+
+} // end namespace
+} // end namespace
+
+#endif /*! _PCTL_PAGGREGATE_H_ */
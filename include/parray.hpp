@@ -129,6 +129,11 @@ public:
     pmem::copy(other.cbegin(), other.cend(), begin());
   }
   
+  parray(parray&& other)
+  : ptr(std::move(other.ptr)), sz(other.sz) {
+    other.sz = 0l;
+  }
+  
   parray(iterator lo, iterator hi) {
     long n = hi - lo;
     if (n < 0) {
@@ -139,6 +139,41 @@ void for_each(Iter lo, Iter hi, const Visit_item& visit_item) {
   });
 }
 
+/* Each segment is checked in place, and its first item is compared
+ * with the item just before it, at the cost of one random access per
+ * segment. As in `find_first_index_rec`, the items are visited in
+ * rounds of doubling size, and the check stops after the first round
+ * that finds a descent; segments visited after the descent is found
+ * are skipped.
+ */
+template <class Iter, class Compare>
+bool is_sorted(Iter lo, Iter hi, const Compare& compare) {
+  using pointer = pointer_of<Iter>;
+  long n = hi - lo;
+  std::atomic<bool> sorted(true);
+  long i = 0;
+  long k = DATAPAR_THRESHOLD;
+  while (i < n && sorted.load()) {
+    long j = std::min(n, i + k);
+    Iter round_lo = lo + i;
+    for_each_segmenti(round_lo, lo + j, [&] (long s, pointer seg_lo, pointer seg_hi) {
+      if (! sorted.load(std::memory_order_relaxed)) {
+        return;
+      }
+      bool ok = std::is_sorted(seg_lo, seg_hi, compare);
+      if (ok && seg_lo != seg_hi && i + s > 0) {
+        ok = ! compare(*seg_lo, *(round_lo + (s - 1)));
+      }
+      if (! ok) {
+        sorted.store(false, std::memory_order_relaxed);
+      }
+    });
+    i = j;
+    k *= 2;
+  }
+  return sorted.load();
+}
+
 template <class Chunkedseq>
 void clear(Chunkedseq& seq) {
   using input_type = level4::chunkedseq_input<Chunkedseq>;
@@ -174,7 +209,7 @@ void tabulate_rng_dst(long n,
   auto convert = [&] (input_type& in, Chunkedseq& dst) {
     dst.stream_pushn_back([&] (long i, long n) {
       for (long k = 0; k < n; k++) {
-        body_idx_dst(k + in.lo, tmp[k]);
+        body_idx_dst(in.lo + i + k, tmp[k]);
       }
       const value_type* lo = &tmp[0];
       const value_type* hi = &tmp[n-1]+1;
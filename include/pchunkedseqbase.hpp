@@ -7,7 +7,11 @@
  *
  */
 
+#include <algorithm>
 #include <cmath>
+#include <memory>
+#include <utility>
+#include <vector>
 
 #include "parray.hpp"
 #include "chunkedseq.hpp"
@@ -60,6 +64,149 @@ void tabulate_dst(long n,
 template <class Pred, class Chunkedseq>
 void keep_if(const Pred& p, Chunkedseq& xs, Chunkedseq& dst);
   
+template <class Iter, class Compare>
+bool is_sorted(Iter lo, Iter hi, const Compare& compare);
+  
+} // end namespace
+  
+/*---------------------------------------------------------------------*/
+/* Segment-wise reading and writing */
+  
+namespace chunked {
+  
+/* Reads the items of a chunked sequence from front to back, one
+ * segment at a time, without modifying the sequence. The next segment
+ * is looked up only when the current one has been read. The sequence
+ * must not be modified while it is being read.
+ */
+template <class Chunkedseq>
+class segment_reader {
+public:
+  
+  using value_type = typename Chunkedseq::value_type;
+  using pointer = value_type*;
+  
+private:
+  
+  using iterator = typename Chunkedseq::iterator;
+  using segment_type = typename Chunkedseq::segment_type;
+  
+  // position of the first item that follows the current segment
+  iterator next;
+  iterator last;
+  pointer lo;
+  pointer hi;
+  long nb_read;
+  
+  void load() {
+    if (next == last) {
+      return;
+    }
+    segment_type seg = next.get_segment();
+    lo = seg.middle;
+    hi = lo + std::min((long)(seg.end - seg.middle), (long)(last - next));
+    next += hi - lo;
+  }
+  
+public:
+  
+  segment_reader(Chunkedseq& xs)
+  : next(xs.begin()), last(xs.end()), lo(nullptr), hi(nullptr), nb_read(0) {
+    load();
+  }
+  
+  bool empty() const {
+    return lo == hi;
+  }
+  
+  const value_type& front() const {
+    return *lo;
+  }
+  
+  void pop_front() {
+    lo++;
+    nb_read++;
+    if (lo == hi) {
+      load();
+    }
+  }
+  
+  // number of items popped so far
+  long size_read() const {
+    return nb_read;
+  }
+  
+};
+  
+/* Appends items to the back of a chunked sequence through a buffer of
+ * the size of one chunk, which is written with a single `pushn_back`
+ * each time it fills up. The buffer must be flushed before the
+ * sequence is used. The buffer is raw storage, allocated once per
+ * writer, in which items are copy constructed, so the items need not
+ * be default constructible.
+ */
+template <class Chunkedseq>
+class segment_writer {
+public:
+  
+  using value_type = typename Chunkedseq::value_type;
+  
+private:
+  
+  Chunkedseq& dst;
+  std::allocator<value_type> alloc;
+  value_type* buffer;
+  long capacity;
+  long nb;
+  
+  void destroy_buffered() {
+    for (long i = 0; i < nb; i++) {
+      buffer[i].~value_type();
+    }
+    nb = 0;
+  }
+  
+public:
+  
+  segment_writer(Chunkedseq& dst)
+  : dst(dst), capacity(std::max(1L, (long)dst.chunk_capacity)), nb(0) {
+    buffer = alloc.allocate(capacity);
+  }
+  
+  segment_writer(const segment_writer&) = delete;
+  segment_writer& operator=(const segment_writer&) = delete;
+  
+  ~segment_writer() {
+    destroy_buffered();
+    alloc.deallocate(buffer, capacity);
+  }
+  
+  void push_back(const value_type& x) {
+    new (buffer + nb) value_type(x);
+    nb++;
+    if (nb == capacity) {
+      flush();
+    }
+  }
+  
+  bool empty() const {
+    return nb == 0 && dst.empty();
+  }
+  
+  // last item appended, or last item of the sequence
+  const value_type& back() const {
+    return (nb > 0) ? buffer[nb - 1] : dst.back();
+  }
+  
+  void flush() {
+    if (nb > 0) {
+      dst.pushn_back(buffer, nb);
+      destroy_buffered();
+    }
+  }
+  
+};
+  
 } // end namespace
   
 /*---------------------------------------------------------------------*/
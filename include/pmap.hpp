@@ -114,18 +114,71 @@ public:
     set.erase(std::make_pair(k, mapped_type()));
   }
   
+  // items whose keys are already in the container are not inserted
+  template <class Iter>
+  void insert_batch(Iter lo, Iter hi) {
+    set.insert_batch(lo, hi);
+  }
+  
+  void insert_batch(const parray<value_type>& xs) {
+    set.insert_batch(xs);
+  }
+  
+  template <class Iter>
+  void erase_batch(Iter lo, Iter hi) {
+    parray<value_type> xs(hi - lo, [&] (long i) {
+      return std::make_pair(*(lo + i), mapped_type());
+    });
+    set.erase_batch(xs);
+  }
+  
+  void erase_batch(const parray<key_type>& ks) {
+    erase_batch(ks.cbegin(), ks.cend());
+  }
+  
   mapped_type& operator[] (const key_type& k) {
-    mapped_type tmp;
-    value_type val = std::make_pair(k, tmp);
-    set.insert(val);
-    auto it = set.find(val);
+    auto it = set.insert(std::make_pair(k, mapped_type())).first;
     return (*it).second;
   }
   
+  /* Inserts the key `k` with a value-initialized item, if `k` is not
+   * yet present, and then calls `f` on a reference to the item of `k`.
+   * The container is searched only once.
+   */
+  template <class Update>
+  mapped_type& upsert(const key_type& k, const Update& f) {
+    mapped_type& v = (*this)[k];
+    f(v);
+    return v;
+  }
+  
+  /* Inserts `kv`, if its key is not yet present, and otherwise replaces
+   * the item `v` of the key by `combine(v, kv.second)`.
+   */
+  template <class Combine>
+  iterator insert_or_combine(const value_type& kv, const Combine& combine) {
+    auto r = set.insert(kv);
+    if (r.second) {
+      (*r.first).second = combine((*r.first).second, kv.second);
+    }
+    return r.first;
+  }
+  
+  // on equal keys, the item of the current container is kept
   void merge(pmap& other) {
     set.merge(other.set);
   }
   
+  /* Same as `merge`, but on equal keys, the items `x` of the current
+   * container and `y` of `other` are replaced by `combine(x, y)`.
+   */
+  template <class Combine>
+  void merge_with(pmap& other, const Combine& combine) {
+    set.merge_with(other.set, [&] (const value_type& x, const value_type& y) {
+      return value_type(x.first, combine(x.second, y.second));
+    });
+  }
+  
   void intersect(pmap& other) {
     set.intersect(other.set);
   }
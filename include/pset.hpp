@@ -10,6 +10,7 @@
 #include <cmath>
 
 #include "datapar.hpp"
+#include "psort.hpp"
 #include "chunkedseq.hpp"
 
 #ifndef _PCTL_PSET_BASE_H_
@@ -145,6 +146,24 @@ namespace {
   template <class Item>
   controller_type pset_diff_chunkedseq_contr<Item>::contr("pset_diff"+sota<Item>());
   
+// cost of splitting the larger input by a key, relative to that of
+// reading one item in a linear pass over both inputs
+#define PSET_SPLIT_COST 16
+  
+  /* The sequential union, intersection and difference of n and m items
+   * read both inputs linearly when their sizes are close, and split the
+   * larger input around the items of the smaller one otherwise, which
+   * takes time in O(m log(n / m + 1)) for m <= n.
+   */
+  inline bool by_splits(long n, long m) {
+    return (n > 0) && (m > 0)
+        && PSET_SPLIT_COST * split_merge_complexity(n, m) < merge_complexity(n, m);
+  }
+  
+  inline par::complexity_type set_operation_complexity(long n, long m) {
+    return std::min(merge_complexity(n, m), PSET_SPLIT_COST * split_merge_complexity(n, m));
+  }
+  
 } // end namespace
   
   template <class value_type, int chunk_capacity, class cache_type>
@@ -247,117 +266,184 @@ private:
     return it;
   }
   
-  static container_type merge_seq(container_type& xs, container_type& ys) {
-    container_type result;
-    key_compare compare;
+  /* Moves the items of xs that have not been read by `reader` to the
+   * back of `result`, by split and concatenation, and empties xs.
+   */
+  static void concat_unread(container_type& xs, const chunked::segment_reader<container_type>& reader,
+                            container_type& result) {
+    container_type rest;
+    xs.split((size_t)reader.size_read(), rest);
+    xs.clear();
+    result.concat(rest);
+  }
+  
+  // on equal keys, the item of xs is kept
+  class keep_first {
+  public:
+    
+    const value_type& operator()(const value_type& x, const value_type&) const {
+      return x;
+    }
+    
+  };
+  
+  /* Splits the smaller of xs and ys at its middle item, and the larger
+   * one by the key of that item, so that, on return, the keys of xs and
+   * ys are smaller than this key, the keys of xs2 and ys2 are larger,
+   * and xs_mid and ys_mid hold the items of xs and ys with this key, if
+   * any. The two sequences keep their roles, so that equal keys stay
+   * paired in the same way. The smaller sequence loses at least one
+   * item, and the larger one is split by key only, so that a recursion
+   * on m <= n items makes O(m log(n / m + 1)) splits in total.
+   */
+  static void split_by_smaller(container_type& xs, container_type& ys,
+                               container_type& xs2, container_type& ys2,
+                               container_type& xs_mid, container_type& ys_mid) {
     long n = xs.size();
     long m = ys.size();
-    while (true) {
-      if (n < m) {
-        std::swap(n, m);
-        xs.swap(ys);
-      }
-      if (n == 0) {
-        // xs.empty() implies that ys.empty()
-        break;
-      } else if (m == 0) {
-        if (same_key(xs.front(), result.back())) {
-          xs.pop_front();
-          n--;
-        }
-        result.concat(xs);
-        break;
+    bool xs_smaller = (n <= m);
+    container_type& smaller = xs_smaller ? xs : ys;
+    container_type& smaller2 = xs_smaller ? xs2 : ys2;
+    container_type& smaller_mid = xs_smaller ? xs_mid : ys_mid;
+    container_type& larger = xs_smaller ? ys : xs;
+    container_type& larger2 = xs_smaller ? ys2 : xs2;
+    container_type& larger_mid = xs_smaller ? ys_mid : xs_mid;
+    smaller.split((size_t)std::min(n, m)/2, smaller2);
+    smaller_mid.push_back(smaller2.pop_front());
+    option_type mid(smaller_mid.back());
+    larger.split([&] (const option_type& key) {
+      return less_than_or_equal(mid, key);
+    }, larger2);
+    if (! larger2.empty() && same_option(option_type(larger2.front()), mid)) {
+      larger_mid.push_back(larger2.pop_front());
+    }
+  }
+  
+  /* Computes operation(xs, ys) by split_by_smaller, as the
+   * concatenation of the results of `operation` on the pieces of keys
+   * smaller and larger than the middle one, made in parallel if
+   * `parallel`, and of `operation_seq` on the items with the middle key.
+   */
+  template <class Operation, class Operation_seq>
+  static container_type split_and_join(container_type& xs, container_type& ys, bool parallel,
+                                       const Operation& operation, const Operation_seq& operation_seq) {
+    container_type xs2;
+    container_type ys2;
+    container_type xs_mid;
+    container_type ys_mid;
+    split_by_smaller(xs, ys, xs2, ys2, xs_mid, ys_mid);
+    container_type result;
+    container_type result2;
+    if (parallel) {
+      par::fork2([&] {
+        result = operation(xs, ys);
+      }, [&] {
+        result2 = operation(xs2, ys2);
+      });
+    } else {
+      result = operation(xs, ys);
+      result2 = operation(xs2, ys2);
+    }
+    container_type result_mid = operation_seq(xs_mid, ys_mid);
+    result.concat(result_mid);
+    result.concat(result2);
+    return result;
+  }
+  
+  // on equal keys x of xs and y of ys, the item combine(x, y) is kept
+  template <class Combine>
+  static container_type merge_seq(container_type& xs, container_type& ys, const Combine& combine) {
+    if (by_splits(xs.size(), ys.size())) {
+      auto operation = [&] (container_type& xs, container_type& ys) {
+        return merge_seq(xs, ys, combine);
+      };
+      return split_and_join(xs, ys, false, operation, operation);
+    }
+    container_type result;
+    key_compare compare;
+    chunked::segment_reader<container_type> xs_reader(xs);
+    chunked::segment_reader<container_type> ys_reader(ys);
+    chunked::segment_writer<container_type> writer(result);
+    while (! xs_reader.empty() && ! ys_reader.empty()) {
+      const value_type& x = xs_reader.front();
+      const value_type& y = ys_reader.front();
+      if (compare(x, y)) {
+        writer.push_back(x);
+        xs_reader.pop_front();
+      } else if (compare(y, x)) {
+        writer.push_back(y);
+        ys_reader.pop_front();
       } else {
-        value_type x = xs.front();
-        value_type y = ys.front();
-        if (compare(x, y)) {
-          xs.pop_front();
-          result.push_back(x);
-          n--;
-        } else if (compare(y, x)) {
-          ys.pop_front();
-          result.push_back(y);
-          m--;
-        } else {
-          xs.pop_front();
-          n--;
-        }
+        writer.push_back(combine(x, y));
+        xs_reader.pop_front();
+        ys_reader.pop_front();
       }
     }
+    writer.flush();
+    concat_unread(xs, xs_reader, result);
+    concat_unread(ys, ys_reader, result);
     return result;
   }
   
-  static container_type merge(container_type& xs, container_type& ys) {
+  template <class Combine>
+  static container_type merge(container_type& xs, container_type& ys, const Combine& combine) {
     using controller_type = pset_merge_chunkedseq_contr<Item>;
-    key_compare compare;
     long n = xs.size();
     long m = ys.size();
     container_type result;
-    par::cstmt(controller_type::contr, [&] { return n + m; }, [&] {
-      if (n < m) {
-        result = merge(ys, xs);
+    par::cstmt(controller_type::contr, [&] { return set_operation_complexity(n, m); }, [&] {
+      if (m == 0) {
+        result = std::move(xs);
       } else if (n == 0) {
-        result = { };
-      } else if (n == 1) {
-        if (m == 0) {
-          result.push_back(xs.back());
-        } else if (same_key(xs.back(), ys.back())) {
-          result.push_back(xs.back());
-        } else {
-          result.push_back(std::min(xs.back(), ys.back(), compare));
-          result.push_back(std::max(xs.back(), ys.back(), compare));
-        }
+        result = std::move(ys);
       } else {
-        container_type xs2;
-        xs.split((size_t)n/2, xs2);
-        value_type mid = xs.back();
-        container_type ys2;
-        ys.split([&] (const option_type& key) {
-          return option_compare(option_type(mid), key);
-        }, ys2);
-        container_type result2;
-        par::fork2([&] {
-          result = merge(xs, ys);
-        }, [&] {
-          result2 = merge(xs2, ys2);
+        result = split_and_join(xs, ys, true, [&] (container_type& xs, container_type& ys) {
+          return merge(xs, ys, combine);
+        }, [&] (container_type& xs, container_type& ys) {
+          return merge_seq(xs, ys, combine);
         });
-        result.concat(result2);
       }
     }, [&] {
-      result = merge_seq(xs, ys);
+      result = merge_seq(xs, ys, combine);
     });
     return result;
   }
   
+  // on equal keys, the item of xs is kept
+  static container_type merge(container_type& xs, container_type& ys) {
+    return merge(xs, ys, keep_first());
+  }
+  
   static container_type merge_par(container_type& xs, container_type& ys) {
     return merge(xs, ys);
   }
   
   static container_type intersect_seq(container_type& xs, container_type& ys) {
+    if (by_splits(xs.size(), ys.size())) {
+      auto operation = [&] (container_type& xs, container_type& ys) {
+        return intersect_seq(xs, ys);
+      };
+      return split_and_join(xs, ys, false, operation, operation);
+    }
     key_compare compare;
     container_type result;
-    long n = xs.size();
-    long m = ys.size();
-    while (true) {
-      if ((n == 0) || (m == 0)) {
-        break;
-      }
-      value_type x = xs.front();
-      value_type y = ys.front();
+    chunked::segment_reader<container_type> xs_reader(xs);
+    chunked::segment_reader<container_type> ys_reader(ys);
+    chunked::segment_writer<container_type> writer(result);
+    while (! xs_reader.empty() && ! ys_reader.empty()) {
+      const value_type& x = xs_reader.front();
+      const value_type& y = ys_reader.front();
       if (compare(x, y)) {
-        xs.pop_front();
-        n--;
+        xs_reader.pop_front();
       } else if (compare(y, x)) {
-        ys.pop_front();
-        m--;
+        ys_reader.pop_front();
       } else { // then, x == y
-        xs.pop_front();
-        n--;
-        ys.pop_front();
-        m--;
-        result.push_back(x);
+        writer.push_back(x);
+        xs_reader.pop_front();
+        ys_reader.pop_front();
       }
     }
+    writer.flush();
     xs.clear();
     ys.clear();
     return result;
@@ -368,30 +454,16 @@ private:
     long n = xs.size();
     long m = ys.size();
     container_type result;
-    par::cstmt(controller_type::contr, [&] { return n + m; }, [&] {
-      if (n < m) {
-        result = intersect(ys, xs);
-      } else if (n == 0) {
-        result = { };
-      } else if ((n == 1) && (m == 1) && same_key(xs.back(), ys.back())) {
-        result.push_back(xs.back());
-      } else if (n == 1) {
-        result = { };
+    par::cstmt(controller_type::contr, [&] { return set_operation_complexity(n, m); }, [&] {
+      if (n == 0 || m == 0) {
+        xs.clear();
+        ys.clear();
       } else {
-        container_type xs2;
-        xs.split((size_t)n/2, xs2);
-        value_type mid = xs.back();
-        container_type ys2;
-        ys.split([&] (const option_type& key) {
-          return option_compare(option_type(mid), key);
-        }, ys2);
-        container_type result2;
-        par::fork2([&] {
-          result = intersect(xs, ys);
-        }, [&] {
-          result2 = intersect(xs2, ys2);
+        result = split_and_join(xs, ys, true, [&] (container_type& xs, container_type& ys) {
+          return intersect(xs, ys);
+        }, [&] (container_type& xs, container_type& ys) {
+          return intersect_seq(xs, ys);
         });
-        result.concat(result2);
       }
     }, [&] {
       result = intersect_seq(xs, ys);
@@ -400,32 +472,33 @@ private:
   }
   
   static container_type diff_seq(container_type& xs, container_type& ys) {
+    if (by_splits(xs.size(), ys.size())) {
+      auto operation = [&] (container_type& xs, container_type& ys) {
+        return diff_seq(xs, ys);
+      };
+      return split_and_join(xs, ys, false, operation, operation);
+    }
     key_compare compare;
     container_type result;
-    long n = xs.size();
-    long m = ys.size();
-    while (true) {
-      if ((n == 0) || (m == 0)) {
-        break;
-      }
-      value_type x = xs.front();
-      value_type y = ys.front();
+    chunked::segment_reader<container_type> xs_reader(xs);
+    chunked::segment_reader<container_type> ys_reader(ys);
+    chunked::segment_writer<container_type> writer(result);
+    while (! xs_reader.empty() && ! ys_reader.empty()) {
+      const value_type& x = xs_reader.front();
+      const value_type& y = ys_reader.front();
       if (compare(x, y)) {
-        result.push_back(x);
-        xs.pop_front();
-        n--;
+        writer.push_back(x);
+        xs_reader.pop_front();
       } else if (compare(y, x)) {
-        ys.pop_front();
-        m--;
+        ys_reader.pop_front();
       } else {
-        xs.pop_front();
-        n--;
-        ys.pop_front();
-        m--;
+        xs_reader.pop_front();
+        ys_reader.pop_front();
       }
     }
+    writer.flush();
     ys.clear();
-    result.concat(xs);
+    concat_unread(xs, xs_reader, result);
     return result;
   }
   
@@ -435,38 +508,17 @@ private:
     long n = xs.size();
     long m = ys.size();
     container_type result;
-    par::cstmt(controller_type::contr, [&] { return n + m; }, [&] {
+    par::cstmt(controller_type::contr, [&] { return set_operation_complexity(n, m); }, [&] {
       if (m == 0) {
         result = std::move(xs);
       } else if (n == 0) {
-        result = { };
-      } else if (n == 1) {
-        iterator it = ys.begin();
-        it.search_by([&] (const option_type& key) {
-          return less_than_or_equal(option_type(xs.back()), key);
-        });
-        if (it == ys.end()) {
-          result = std::move(xs);
-        } else if (! same_option(*it, option_type(xs.back()))) {
-          result = std::move(xs);
-        } else {
-          result = { };
-        }
+        ys.clear();
       } else {
-        container_type xs2;
-        xs.split((size_t)n/2, xs2);
-        value_type mid = xs.back();
-        container_type ys2;
-        ys.split([&] (const option_type& key) {
-          return option_compare(option_type(mid), key);
-        }, ys2);
-        container_type result2;
-        par::fork2([&] {
-          result = diff(xs, ys);
-        }, [&] {
-          result2 = diff(xs2, ys2);
+        result = split_and_join(xs, ys, true, [&] (container_type& xs, container_type& ys) {
+          return diff(xs, ys);
+        }, [&] (container_type& xs, container_type& ys) {
+          return diff_seq(xs, ys);
         });
-        result.concat(result2);
       }
     }, [&] {
       result = diff_seq(xs, ys);
@@ -475,22 +527,22 @@ private:
   }
   
   container_type sort_seq(container_type& xs) {
+    key_compare compare;
     container_type result;
     long n = xs.size();
     parray<value_type> tmp(n);
     xs.backn(tmp.begin(), n);
     xs.clear();
     if (n > 1) {
-      std::sort(tmp.begin(), tmp.end());
+      std::sort(tmp.begin(), tmp.end(), compare);
     }
-    long i = 0;
-    for (auto it = tmp.cbegin(); it != tmp.cend(); it++, i++) {
-      value_type v = *it;
-      if (i > 0 && same_key(v, result.back())) {
-        continue;
+    chunked::segment_writer<container_type> writer(result);
+    for (auto it = tmp.cbegin(); it != tmp.cend(); it++) {
+      if (writer.empty() || ! same_key(*it, writer.back())) {
+        writer.push_back(*it);
       }
-      result.push_back(v);
     }
+    writer.flush();
     return result;
   }
   
@@ -529,7 +581,7 @@ private:
     output_type out;
     container_type result;
     auto convert_reduce_comp = [&] (input_type& in) {
-      return in.seq.size(); // later: use correct value
+      return sort_complexity(in.seq.size());
     };
     auto convert_reduce = [&] (input_type& in, container_type& dst) {
       dst = std::move(sort_seq(in.seq));
@@ -617,6 +669,7 @@ public:
     if (it == seq.end()) {
       // val is currently the largest item in the container
       seq.push_back(val);
+      it = seq.begin() + (seq.size() - 1);
     } else if (same_key(*it, val)) {
       // val is present in the container
       already = true;
@@ -644,6 +697,34 @@ public:
     return nb - seq.size();
   }
   
+  /* Inserts the items of [lo, hi) that are not yet in the container.
+   * The batch is sorted and deduplicated in parallel, like by the
+   * iterator constructor, and then merged into the container, so items
+   * already present are kept.
+   */
+  template <class Iter>
+  void insert_batch(Iter lo, Iter hi) {
+    pset batch(lo, hi);
+    seq = merge(seq, batch.seq);
+    init();
+  }
+  
+  void insert_batch(const parray<value_type>& xs) {
+    insert_batch(xs.cbegin(), xs.cend());
+  }
+  
+  // Removes the items whose keys are in [lo, hi), by a parallel difference.
+  template <class Iter>
+  void erase_batch(Iter lo, Iter hi) {
+    pset batch(lo, hi);
+    seq = diff(seq, batch.seq);
+    init();
+  }
+  
+  void erase_batch(const parray<key_type>& xs) {
+    erase_batch(xs.cbegin(), xs.cend());
+  }
+  
   iterator begin() const {
     return seq.begin();
   }
@@ -667,16 +748,31 @@ public:
   void merge(pset& other) {
     seq = merge(seq, other.seq);
     other.clear();
+    init();
+  }
+  
+  /* Same as `merge`, but when both containers hold an item with the
+   * same key, the item `combine(x, y)` is kept, where `x` is the item of
+   * the current container and `y` that of `other`. The calls to
+   * `combine` are made in parallel, during the merge.
+   */
+  template <class Combine>
+  void merge_with(pset& other, const Combine& combine) {
+    seq = merge(seq, other.seq, combine);
+    other.clear();
+    init();
   }
   
   void intersect(pset& other) {
     seq = intersect(seq, other.seq);
     other.clear();
+    init();
   }
   
   void diff(pset& other) {
     seq = diff(seq, other.seq);
     other.clear();
+    init();
   }
   
   void clear() {
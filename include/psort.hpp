@@ -7,6 +7,13 @@
  *
  */
 
+#include <cmath>
+#include <cstdint>
+#include <limits>
+#include <type_traits>
+#include <utility>
+#include <vector>
+
 #include "datapar.hpp"
 
 #ifndef _PCTL_PSORT_H_
@@ -17,6 +24,58 @@ namespace pctl {
 
 /***********************************************************************/
   
+/*---------------------------------------------------------------------*/
+/* Complexity measures */
+  
+/* The controlled statements of this file and of pset.hpp measure the
+ * complexity of their sequential alternative with the functions below.
+ * Each function is proportional to the running time of that
+ * alternative, so that the constant learned by the estimator of the
+ * statement does not depend on the size of the input. The program
+ * test/complexity.cpp checks that these constants agree across sizes.
+ */
+namespace {
+  
+inline double log2_of(long n) {
+  return std::log2((double)std::max(2L, n));
+}
+  
+// comparison sort of n items
+inline par::complexity_type sort_complexity(long n) {
+  return (par::complexity_type)n * log2_of(n);
+}
+  
+// merge of two sorted sequences of n and m items; this is also the cost
+// of the sequential union, intersection and difference of pset.hpp on
+// inputs of similar sizes, which read each item of both inputs once
+inline par::complexity_type merge_complexity(long n, long m) {
+  return (par::complexity_type)(n + m);
+}
+  
+// union, intersection or difference of two sorted sequences of n and m
+// items, by splitting the larger one around the items of the smaller one
+inline par::complexity_type split_merge_complexity(long n, long m) {
+  long s = std::min(n, m);
+  long l = std::max(n, m);
+  return (par::complexity_type)s * log2_of(l / std::max(1L, s) + 1);
+}
+  
+// merge of k sorted runs holding n items in total, by a balanced tree
+// of two-way merges
+inline par::complexity_type merge_runs_complexity(long n, long k) {
+  return (par::complexity_type)n * log2_of(k);
+}
+  
+// m sorted queries searched by galloping in a sorted sequence of n
+// items, where the search for each query starts from the answer to the
+// previous one
+inline par::complexity_type search_complexity(long m, long n) {
+  m = std::max(1L, m);
+  return (par::complexity_type)m * log2_of(n / m + 1);
+}
+  
+} // end namespace
+  
 /*---------------------------------------------------------------------*/
 /* Merging and sorting for chunked sequences */
 
@@ -24,33 +83,40 @@ namespace pctl {
   
 namespace {
   
+/* Stable merge that reads the items of xs and ys segment by segment,
+ * and writes the merged items by chunks. Once one of the sequences is
+ * exhausted, the rest of the other is moved to the result by split and
+ * concatenation.
+ */
 template <class Chunkedseq, class Compare>
 Chunkedseq merge_seq(Chunkedseq& xs, Chunkedseq& ys, const Compare& compare) {
-  using value_type = typename Chunkedseq::value_type;
   Chunkedseq result;
-  long n = xs.size();
-  long m = ys.size();
-  while (true) {
-    if (n == 0) {
-      result.concat(ys);
-      break;
-    } else if (m == 0) {
-      result.concat(xs);
-      break;
+  if (xs.empty() || ys.empty() || ! compare(ys.front(), xs.back())) {
+    result.concat(xs);
+    result.concat(ys);
+    return result;
+  }
+  chunked::segment_reader<Chunkedseq> xs_reader(xs);
+  chunked::segment_reader<Chunkedseq> ys_reader(ys);
+  chunked::segment_writer<Chunkedseq> writer(result);
+  while (! xs_reader.empty() && ! ys_reader.empty()) {
+    if (compare(ys_reader.front(), xs_reader.front())) {
+      writer.push_back(ys_reader.front());
+      ys_reader.pop_front();
     } else {
-      value_type x = xs.front();
-      value_type y = ys.front();
-      if (compare(x, y)) {
-        xs.pop_front();
-        result.push_back(x);
-        n--;
-      } else {
-        ys.pop_front();
-        result.push_back(y);
-        m--;
-      }
+      writer.push_back(xs_reader.front());
+      xs_reader.pop_front();
     }
   }
+  writer.flush();
+  Chunkedseq xs2;
+  Chunkedseq ys2;
+  xs.split((size_t)xs_reader.size_read(), xs2);
+  ys.split((size_t)ys_reader.size_read(), ys2);
+  xs.clear();
+  ys.clear();
+  result.concat(xs2);
+  result.concat(ys2);
   return result;
 }
   
@@ -89,7 +155,7 @@ Chunkedseq merge_par(Chunkedseq& xs, Chunkedseq& ys, const Compare& compare) {
     return;
   }
 #endif
-  par::cstmt(controller_type::contr, [&] { return n + m; }, [&] {
+  par::cstmt(controller_type::contr, [&] { return merge_complexity(n, m); }, [&] {
     if (n < m) {
       result = std::move(merge_par(ys, xs, compare));
     } else if (n == 0) {
@@ -98,8 +164,13 @@ Chunkedseq merge_par(Chunkedseq& xs, Chunkedseq& ys, const Compare& compare) {
       if (m == 0) {
         result.push_back(xs.back());
       } else {
-        result.push_back(std::min(xs.back(), ys.back(), compare));
-        result.push_back(std::max(xs.back(), ys.back(), compare));
+        if (compare(ys.back(), xs.back())) {
+          result.push_back(ys.back());
+          result.push_back(xs.back());
+        } else {
+          result.push_back(xs.back());
+          result.push_back(ys.back());
+        }
       }
     } else {
       Chunkedseq xs2;
@@ -176,7 +247,7 @@ Chunkedseq mergesort(Chunkedseq& xs, const Compare& compare) {
   output_type out(compare);
   Chunkedseq result;
   auto convert_reduce_comp = [&] (input_type& in) {
-    return in.seq.size(); // later: use correct value
+    return sort_complexity(in.seq.size());
   };
   auto convert_reduce = [&] (input_type& in, Chunkedseq& dst) {
     dst = std::move(sort_seq(in.seq, compare));
@@ -200,6 +271,10 @@ pchunkedseq<Item> merge(pchunkedseq<Item>& xs, pchunkedseq<Item>& ys, const Comp
 template <class Item, class Compare>
 pchunkedseq<Item> mergesort(pchunkedseq<Item>& xs, const Compare& compare) {
   pchunkedseq<Item> result;
+  if (chunked::is_sorted(xs.seq.cbegin(), xs.seq.cend(), compare)) {
+    result.seq.swap(xs.seq);
+    return result;
+  }
   result.seq = std::move(chunked::mergesort(xs.seq, compare));
   return result;
 }
@@ -214,6 +289,12 @@ pchunkedseq<Item> sort(pchunkedseq<Item>& xs, const Compare& compare) {
 /*---------------------------------------------------------------------*/
 /* Merging and sorting for parallel arrays */
   
+// comparison sorts that the `sort` functions can be asked to use
+using sort_engine_type = enum {
+  mergesort_engine,
+  samplesort_engine
+};
+  
 namespace {
 
 template <class Item>
@@ -223,6 +304,123 @@ void copy(const Item* src, Item* dst,
     std::copy(&src[lo_src], &src[hi_src-1]+1, &dst[lo_dst]);
 }
 
+#define PSORT_NETWORK_SIZE 16
+#define PSORT_NETWORK_LEAF 4096
+  
+// holds if the items can be compared by the branch-free kernels below
+template <class Item, class Compare>
+class use_sorting_network : public std::false_type { };
+  
+template <class Item>
+class use_sorting_network<Item, std::less<Item>>
+  : public std::integral_constant<bool, std::is_arithmetic<Item>::value && ! std::is_same<Item, bool>::value> { };
+  
+// one comparison, so that equivalent but distinct items (e.g., -0.0
+// and 0.0) are exchanged rather than duplicated
+template <class Item>
+void compare_exchange(Item& x, Item& y) {
+  bool c = y < x;
+  Item lo = c ? y : x;
+  Item hi = c ? x : y;
+  x = lo;
+  y = hi;
+}
+  
+/* Sorts the PSORT_NETWORK_SIZE items of xs by a bitonic sorting
+ * network. The loops have constant bounds, so that the compiler can
+ * unroll them into a straight-line sequence of comparisons and
+ * conditional moves, which it may vectorize.
+ */
+template <class Item>
+void sorting_network(Item* xs) {
+  const int n = PSORT_NETWORK_SIZE;
+  for (int k = 2; k <= n; k *= 2) {
+    for (int j = k / 2; j > 0; j /= 2) {
+      for (int i = 0; i < n; i++) {
+        int l = i ^ j;
+        if (l > i) {
+          if ((i & k) == 0) {
+            compare_exchange(xs[i], xs[l]);
+          } else {
+            compare_exchange(xs[l], xs[i]);
+          }
+        }
+      }
+    }
+  }
+}
+  
+// merge whose loop does not branch on the outcome of the comparisons
+template <class Item>
+void branch_free_merge(const Item* xs, long n1, const Item* ys, long n2, Item* dst) {
+  long i = 0;
+  long j = 0;
+  long k = 0;
+  while (i < n1 && j < n2) {
+    Item x = xs[i];
+    Item y = ys[j];
+    bool c = y < x;
+    dst[k++] = c ? y : x;
+    i += 1 - c;
+    j += c;
+  }
+  std::copy(xs + i, xs + n1, dst + k);
+  std::copy(ys + j, ys + n2, dst + k + (n1 - i));
+}
+  
+/* Sorts xs[lo, hi) and stores the result in tmp[lo, hi) if `into_tmp`
+ * holds, or else in xs[lo, hi), the other array being used as scratch
+ * space. Ranges larger than PSORT_NETWORK_LEAF are split in halves,
+ * so that the passes below stay within the cache. Blocks of
+ * PSORT_NETWORK_SIZE items are sorted by the sorting network, and then
+ * merged bottom up by the branch-free merge. The network writes its
+ * output to the array that makes the last merge pass end in the
+ * destination.
+ */
+template <class Item>
+void network_mergesort(Item* xs, Item* tmp, long lo, long hi, bool into_tmp) {
+  long n = hi - lo;
+  if (n > PSORT_NETWORK_LEAF) {
+    long mid = (lo + hi) / 2;
+    network_mergesort(xs, tmp, lo, mid, ! into_tmp);
+    network_mergesort(xs, tmp, mid, hi, ! into_tmp);
+    Item* src = into_tmp ? xs : tmp;
+    Item* dst = into_tmp ? tmp : xs;
+    std::merge(src + lo, src + mid, src + mid, src + hi, dst + lo);
+    return;
+  }
+  int nb_passes = 0;
+  for (long w = PSORT_NETWORK_SIZE; w < n; w *= 2) {
+    nb_passes++;
+  }
+  Item* dst = into_tmp ? tmp : xs;
+  Item* other = into_tmp ? xs : tmp;
+  Item* src = (nb_passes % 2 == 0) ? dst : other;
+  long b = lo;
+  for (; b + PSORT_NETWORK_SIZE <= hi; b += PSORT_NETWORK_SIZE) {
+    Item block[PSORT_NETWORK_SIZE];
+    std::copy(xs + b, xs + b + PSORT_NETWORK_SIZE, block);
+    sorting_network(block);
+    std::copy(block, block + PSORT_NETWORK_SIZE, src + b);
+  }
+  if (b < hi) {
+    Item block[PSORT_NETWORK_SIZE];
+    std::copy(xs + b, xs + hi, block);
+    std::sort(block, block + (hi - b));
+    std::copy(block, block + (hi - b), src + b);
+  }
+  Item* trg = (src == dst) ? other : dst;
+  for (long w = PSORT_NETWORK_SIZE; w < n; w *= 2) {
+    for (long l = lo; l < hi; l += 2 * w) {
+      long m = std::min(hi, l + w);
+      long h = std::min(hi, l + 2 * w);
+      branch_free_merge(src + l, m - l, src + m, h - m, trg + l);
+    }
+    std::swap(src, trg);
+  }
+  assert(src == dst);
+}
+  
 template <class Item, class Compare>
 void merge_seq(const Item* xs, const Item* ys, Item* tmp,
                long lo_xs, long hi_xs,
@@ -233,122 +431,599 @@ void merge_seq(const Item* xs, const Item* ys, Item* tmp,
 }
   
 template <class Item, class Compare>
-long lower_bound(const Item* xs, long lo, long hi, const Item& val, const Compare& compare) {
-  const Item* first_xs = &xs[0];
-  return std::lower_bound(first_xs+lo, first_xs+hi, val, compare)-first_xs;
+void mergesort_seq(Item* xs, Item* tmp, long lo, long hi, bool into_tmp, const Compare& compare, std::false_type) {
+  Item* dst = xs;
+  if (into_tmp) {
+    std::copy(xs + lo, xs + hi, tmp + lo);
+    dst = tmp;
+  }
+  std::sort(dst + lo, dst + hi, compare);
+}
+  
+template <class Item, class Compare>
+void mergesort_seq(Item* xs, Item* tmp, long lo, long hi, bool into_tmp, const Compare&, std::true_type) {
+  network_mergesort(xs, tmp, lo, hi, into_tmp);
+}
+  
+#define PSORT_MERGE_BLOCK 2048
+  
+/* Returns the number of items taken from xs[lo_xs, hi_xs) among the
+ * first k items of the stable merge of xs[lo_xs, hi_xs) and
+ * ys[lo_ys, hi_ys), that is, the position at which the k-th diagonal
+ * of the merge path crosses the path. Items of xs come before equal
+ * items of ys.
+ */
+template <class Item, class Compare>
+long merge_co_rank(const Item* xs, const Item* ys,
+                   long lo_xs, long hi_xs,
+                   long lo_ys, long hi_ys,
+                   long k,
+                   const Compare& compare) {
+  long n1 = hi_xs - lo_xs;
+  long n2 = hi_ys - lo_ys;
+  long lo = std::max(0L, k - n2);
+  long hi = std::min(k, n1);
+  while (lo < hi) {
+    long i = lo + (hi - lo) / 2;
+    long j = k - i;
+    if (! compare(ys[lo_ys + j - 1], xs[lo_xs + i])) {
+      lo = i + 1;
+    } else {
+      hi = i;
+    }
+  }
+  return lo;
 }
 
+/* Stable parallel merge of xs[lo_xs, hi_xs) and ys[lo_ys, hi_ys) into
+ * tmp[lo_tmp, ...), by merge path: the output is cut in blocks of
+ * PSORT_MERGE_BLOCK items, the position of the cut in each input is
+ * found by `merge_co_rank`, and every block is then merged
+ * sequentially. All blocks have the same cost, whatever the relative
+ * sizes and contents of the inputs.
+ */
+template <class Item, class Compare>
+void merge_par(const Item* xs, const Item* ys, Item* tmp,
+               long lo_xs, long hi_xs,
+               long lo_ys, long hi_ys,
+               long lo_tmp,
+               const Compare& compare) {
+  long n = (hi_xs - lo_xs) + (hi_ys - lo_ys);
+  if (n <= PSORT_MERGE_BLOCK) {
+    merge_seq(xs, ys, tmp, lo_xs, hi_xs, lo_ys, hi_ys, lo_tmp, compare);
+    return;
+  }
+  long nb_blocks = (n + PSORT_MERGE_BLOCK - 1) / PSORT_MERGE_BLOCK;
+  auto merge_blocks = [&] (long bl, long br) {
+    long k1 = bl * PSORT_MERGE_BLOCK;
+    long k2 = std::min(n, br * PSORT_MERGE_BLOCK);
+    long i1 = merge_co_rank(xs, ys, lo_xs, hi_xs, lo_ys, hi_ys, k1, compare);
+    long i2 = merge_co_rank(xs, ys, lo_xs, hi_xs, lo_ys, hi_ys, k2, compare);
+    merge_seq(xs, ys, tmp, lo_xs + i1, lo_xs + i2, lo_ys + k1 - i1, lo_ys + k2 - i2, lo_tmp + k1, compare);
+  };
+  range::parallel_for(0L, nb_blocks, [&] (long l, long r) { return (r - l) * PSORT_MERGE_BLOCK; }, [&] (long b) {
+    merge_blocks(b, b + 1);
+  }, merge_blocks);
+}
+ 
 template <class Item>
-class merge_parray_contr {
+class mergesort_parray_contr {
 public:
   static controller_type contr;
 };
 
 template <class Item>
-controller_type merge_parray_contr<Item>::contr("merge"+sota<Item>());
-
+controller_type mergesort_parray_contr<Item>::contr("mergesort"+sota<Item>());
+  
+/* Sorts the items of xs[lo, hi) and stores the result in tmp[lo, hi)
+ * if `into_tmp` holds, or else back in xs[lo, hi). The two halves are
+ * sorted into the buffer that is not the destination, and then merged
+ * into the destination, so that the buffers alternate from one level
+ * of the merge tree to the next and no merge is followed by a copy.
+ * Only the leaves that have to store their result in tmp copy their
+ * items, and they do so before sorting them in place. The leaves of
+ * arithmetic items compared by `std::less` use `network_mergesort`
+ * instead, which writes directly to the right array.
+ */
 template <class Item, class Compare>
-void merge_par(const Item* xs, const Item* ys, Item* tmp,
-               long lo_xs, long hi_xs,
-               long lo_ys, long hi_ys,
-               long lo_tmp,
-               const Compare& compare) {
-  using controller_type = merge_parray_contr<Item>;
-  long n1 = hi_xs-lo_xs;
-  long n2 = hi_ys-lo_ys;
+void mergesort_rec(Item* xs, Item* tmp, long lo, long hi, bool into_tmp, const Compare& compare) {
+  using controller_type = mergesort_parray_contr<Item>;
+  long n = hi - lo;
+  auto seq = [&] {
+    mergesort_seq(xs, tmp, lo, hi, into_tmp, compare, use_sorting_network<Item, Compare>());
+  };
 #ifdef MANUAL_CONTROL
-  if (n1 + n2 < PSORT_THRESHOLD) {
-    merge_seq(xs, ys, tmp, lo_xs, hi_xs, lo_ys, hi_ys, lo_tmp, compare);
+  if (n < PSORT_THRESHOLD) {
+    seq();
     return;
   }
 #endif
-  par::cstmt(controller_type::contr, [&] { return n1+n2; }, [&] {
-    if (n1 < n2) {
-      // to ensure that the first subarray being sorted is the larger or the two
-      merge_par(ys, xs, tmp, lo_ys, hi_ys, lo_xs, hi_xs, lo_tmp, compare);
-    } else if (n1 == 0) {
-      // xs and ys empty
-    } else if (n1 == 1) {
-      if (n2 == 0) {
-        // xs singleton; ys empty
-        tmp[lo_tmp] = xs[lo_xs];
-      } else {
-        // both singletons
-        tmp[lo_tmp+0] = std::min(xs[lo_xs], ys[lo_ys], compare);
-        tmp[lo_tmp+1] = std::max(xs[lo_xs], ys[lo_ys], compare);
+  par::cstmt(controller_type::contr, [&] { return sort_complexity(n); }, [&] {
+    if (n < 2) {
+      seq();
+      return;
+    }
+    long mid = (lo + hi) / 2;
+    par::fork2([&] {
+      mergesort_rec(xs, tmp, lo, mid, ! into_tmp, compare);
+    }, [&] {
+      mergesort_rec(xs, tmp, mid, hi, ! into_tmp, compare);
+    });
+    Item* src = into_tmp ? xs : tmp;
+    Item* dst = into_tmp ? tmp : xs;
+    merge_par(src, src, dst, lo, mid, mid, hi, lo, compare);
+  }, seq);
+}
+  
+template <class Item, class Compare>
+void mergesort_rng(Item* xs, Item* tmp, long lo, long hi, const Compare& compare) {
+  mergesort_rec(xs, tmp, lo, hi, false, compare);
+}
+
+#define PSORT_NATURAL_MIN_RUN 32
+  
+template <class Item>
+class merge_runs_contr {
+public:
+  static controller_type contr;
+};
+
+template <class Item>
+controller_type merge_runs_contr<Item>::contr("merge_runs"+sota<Item>());
+  
+/* Merges the sorted runs [offsets[a], offsets[a + 1]), ...,
+ * [offsets[b - 1], offsets[b]) of xs, and stores the result in tmp if
+ * `into_tmp` holds, or else in xs. As in `mergesort_rec`, the buffers
+ * alternate from one level of the merge tree to the next, and the tree
+ * is balanced in the number of runs, so that each item takes part in
+ * O(log k) merges, for k runs.
+ */
+template <class Item, class Compare>
+void merge_runs_rec(Item* xs, Item* tmp, const long* offsets, long a, long b, bool into_tmp, const Compare& compare) {
+  using controller_type = merge_runs_contr<Item>;
+  long lo = offsets[a];
+  long hi = offsets[b];
+  auto run = [&] (bool par) {
+    if (b - a == 1) {
+      if (into_tmp) {
+        std::copy(xs + lo, xs + hi, tmp + lo);
       }
-    } else {
-      // select pivot positions
-      long mid_xs = (lo_xs+hi_xs)/2;
-      long mid_ys = lower_bound(ys, lo_ys, hi_ys, xs[mid_xs], compare);
-      // number of items to be treated by the first parallel call
-      long k = (mid_xs-lo_xs) + (mid_ys-lo_ys);
+      return;
+    }
+    long mid = (a + b) / 2;
+    Item* src = into_tmp ? xs : tmp;
+    Item* dst = into_tmp ? tmp : xs;
+    if (par) {
       par::fork2([&] {
-        merge_par(xs, ys, tmp, lo_xs, mid_xs, lo_ys, mid_ys, lo_tmp, compare);
+        merge_runs_rec(xs, tmp, offsets, a, mid, ! into_tmp, compare);
       }, [&] {
-        merge_par(xs, ys, tmp, mid_xs, hi_xs, mid_ys, hi_ys, lo_tmp+k, compare);
+        merge_runs_rec(xs, tmp, offsets, mid, b, ! into_tmp, compare);
       });
+      merge_par(src, src, dst, lo, offsets[mid], offsets[mid], hi, lo, compare);
+    } else {
+      merge_runs_rec(xs, tmp, offsets, a, mid, ! into_tmp, compare);
+      merge_runs_rec(xs, tmp, offsets, mid, b, ! into_tmp, compare);
+      merge_seq(src, src, dst, lo, offsets[mid], offsets[mid], hi, lo, compare);
     }
+  };
+  par::cstmt(controller_type::contr, [&] { return merge_runs_complexity(hi - lo, b - a); }, [&] {
+    run(true);
   }, [&] {
-    merge_seq(xs, ys, tmp, lo_xs, hi_xs, lo_ys, hi_ys, lo_tmp, compare);
+    run(false);
   });
 }
- 
-template <class Merge_fct>
-class mergesort_merge_output {
-public:
   
-  using result_type = std::pair<long, long>;
-
-  Merge_fct merge_fct;
+/* Stable mergesort that takes advantage of the order already present
+ * in the input. The strictly descending stretches of xs[0, n) are
+ * reversed, then the maximal ascending runs are located, and the runs
+ * are merged by `merge_runs_rec`. When the runs are shorter than
+ * PSORT_NATURAL_MIN_RUN items on average, the input has too little
+ * order to pay for it, and the runs are made instead of blocks of
+ * PSORT_THRESHOLD items.
+ */
+template <class Item, class Compare>
+void natural_mergesort_rng(Item* xs, Item* tmp, long n, const Compare& compare) {
+  if (pasl::pctl::is_sorted(xs, xs + n, compare)) {
+    return;
+  }
+  // the pairs (i - 1, i) such that xs[i] < xs[i - 1], grouped in
+  // maximal stretches of consecutive pairs
+  auto descent = [&] (long i) {
+    return (i >= 1) && (i < n) && compare(xs[i], xs[i - 1]);
+  };
+  parray<bool> starts_flags(n, [&] (long i) {
+    return descent(i) && ! descent(i - 1);
+  });
+  parray<bool> ends_flags(n, [&] (long i) {
+    return descent(i) && ! descent(i + 1);
+  });
+  parray<long> starts = pack_index(starts_flags.cbegin(), starts_flags.cend());
+  parray<long> ends = pack_index(ends_flags.cbegin(), ends_flags.cend());
+  long nb_stretches = starts.size();
+  // the runs can only break at the ends of the stretches
+  if (2 * nb_stretches + 1 > n / PSORT_NATURAL_MIN_RUN) {
+    // make runs out of blocks sorted by a stable sort
+    long nb_blocks = (n + PSORT_THRESHOLD - 1) / PSORT_THRESHOLD;
+    parray<long> offsets(nb_blocks + 1, [&] (long b) {
+      return std::min(n, b * PSORT_THRESHOLD);
+    });
+    parallel_for(0L, nb_blocks, [&] (long b) {
+      std::stable_sort(xs + offsets[b], xs + offsets[b + 1], compare);
+    });
+    merge_runs_rec(xs, tmp, offsets.cbegin(), 0L, nb_blocks, false, compare);
+    return;
+  }
+  parallel_for(0L, nb_stretches, [&] (long j) {
+    return ends[j] - starts[j] + 2;
+  }, [&] (long j) {
+    std::reverse(xs + starts[j] - 1, xs + ends[j] + 1);
+  });
+  parray<bool> run_flags(n, [&] (long i) {
+    return (i == 0) || compare(xs[i], xs[i - 1]);
+  });
+  parray<long> run_starts = pack_index(run_flags.cbegin(), run_flags.cend());
+  long nb_runs = run_starts.size();
+  parray<long> offsets(nb_runs + 1, [&] (long j) {
+    return (j == nb_runs) ? n : run_starts[j];
+  });
+  merge_runs_rec(xs, tmp, offsets.cbegin(), 0L, nb_runs, false, compare);
+}
   
-  mergesort_merge_output(const Merge_fct& merge_fct)
-  : merge_fct(merge_fct) { }
+#define PSORT_RADIX_BITS 8
+#define PSORT_RADIX_BLOCK 16384
+#define PSORT_RADIX_MAX_BLOCKS 4096
+#define PSORT_RADIX_BUFFER 16
   
-  void init(result_type& rng) const {
-    rng = std::make_pair(0L, 0L);
+// maps an integral key to an unsigned key with the same ordering
+template <class Key>
+typename std::make_unsigned<Key>::type radix_bits_of(Key k) {
+  using unsigned_type = typename std::make_unsigned<Key>::type;
+  unsigned_type u = (unsigned_type)k;
+  if (std::is_signed<Key>::value) {
+    u ^= unsigned_type(1) << (8 * sizeof(Key) - 1);
   }
+  return u;
+}
   
-  void copy(const result_type& src, result_type& dst) const {
-    dst = src;
+// per-worker scatter buffers of one radix sort, allocated on first use
+// and reused across the blocks and the passes of the sort
+template <class Item>
+class radix_buffers {
+public:
+  
+  using buffers_type = perworker::array<parray<Item>*, perworker::get_my_id>;
+  
+  buffers_type buffers;
+  
+  radix_buffers()
+  : buffers(nullptr) { }
+  
+  ~radix_buffers() {
+    buffers.iterate([&] (parray<Item>*& b) {
+      if (b != nullptr) {
+        delete b;
+        b = nullptr;
+      }
+    });
   }
   
-  // dst, src represent left, right range to be merged, respectively
-  void merge(const result_type& src, result_type& dst) const {
-    assert(dst.second == src.first);
-    merge_fct(dst.first, dst.second, src.second);
-    dst.second = src.second;
+  // PSORT_RADIX_BUFFER items for each digit
+  Item* mine() {
+    parray<Item>*& b = buffers.mine();
+    if (b == nullptr) {
+      b = new parray<Item>((1L << PSORT_RADIX_BITS) * PSORT_RADIX_BUFFER);
+    }
+    return b->begin();
   }
   
 };
   
-template <class Item, class Compare>
-void mergesort(Item* xs, Item* tmp, long lo, long hi, const Compare& compare) {
-  using input_type = level4::tabulate_input;
-  auto merge_fct = [&] (long lo, long mid, long hi) {
-    merge_par(xs, xs, tmp, lo, mid, mid, hi, lo, compare);
-    // copy back to source array
-    pmem::copy(&tmp[lo], &tmp[hi], &xs[lo]);
+/* Stable least-significant-digit radix sort of [xs, xs + n), by the
+ * integral keys returned by `key_of`, using [tmp, tmp + n) as scratch
+ * space. Each pass counts the digits of every block of the input, scans
+ * the counts in digit-major order to obtain the destination of each
+ * digit of each block, and then scatters the items of every block
+ * through small per-digit buffers, so that the writes to each
+ * destination are issued in runs. Passes in which all items share the
+ * same digit are skipped.
+ */
+template <class Iter, class Key_of>
+void radix_sort_rng(Iter xs, Iter tmp, long n, const Key_of& key_of) {
+  using value_type = typename std::iterator_traits<Iter>::value_type;
+  using key_type = typename std::decay<decltype(key_of(*xs))>::type;
+  const long nb_digits = 1L << PSORT_RADIX_BITS;
+  const long mask = nb_digits - 1;
+  const int nb_passes = (8 * sizeof(key_type) + PSORT_RADIX_BITS - 1) / PSORT_RADIX_BITS;
+  if (n < PSORT_THRESHOLD) {
+    std::stable_sort(xs, xs + n, [&] (const value_type& x, const value_type& y) {
+      return radix_bits_of(key_of(x)) < radix_bits_of(key_of(y));
+    });
+    return;
+  }
+  long block_size = std::max((long)PSORT_RADIX_BLOCK, (n + PSORT_RADIX_MAX_BLOCKS - 1) / PSORT_RADIX_MAX_BLOCKS);
+  long nb_blocks = (n + block_size - 1) / block_size;
+  auto block_comp = [&] (long l, long r) {
+    return (r - l) * block_size;
   };
-  using output_type = mergesort_merge_output<decltype(merge_fct)>;
-  using result_type = typename output_type::result_type;
-  input_type in(lo, hi);
-  output_type out(merge_fct);
-  result_type id = std::make_pair(0L, 0L);
-  result_type dst = id;
-  auto convert_reduce_comp = [&] (input_type& in) {
-    return in.hi - in.lo;
+  auto combine = [&] (long x, long y) {
+    return x + y;
+  };
+  // counts[d * nb_blocks + b] is the number of items with digit d in block b
+  parray<long> counts(nb_digits * nb_blocks);
+  radix_buffers<value_type> buffers;
+  Iter src = xs;
+  Iter dst = tmp;
+  for (int pass = 0; pass < nb_passes; pass++) {
+    int shift = pass * PSORT_RADIX_BITS;
+    auto digit_of = [&] (const value_type& x) {
+      return (long)((radix_bits_of(key_of(x)) >> shift) & mask);
+    };
+    range::parallel_for(0L, nb_blocks, block_comp, [&] (long b) {
+      long lo = b * block_size;
+      long hi = std::min(n, lo + block_size);
+      long c[1L << PSORT_RADIX_BITS] = { 0 };
+      for (long i = lo; i < hi; i++) {
+        c[digit_of(src[i])]++;
+      }
+      for (long d = 0; d < nb_digits; d++) {
+        counts[d * nb_blocks + b] = c[d];
+      }
+    });
+    dps::scan(counts.begin(), counts.end(), 0L, combine, counts.begin(), forward_exclusive_scan);
+    bool trivial = false;
+    for (long d = 0; d < nb_digits && ! trivial; d++) {
+      long end = (d + 1 < nb_digits) ? counts[(d + 1) * nb_blocks] : n;
+      trivial = (end - counts[d * nb_blocks] == n);
+    }
+    if (trivial) {
+      continue;
+    }
+    range::parallel_for(0L, nb_blocks, block_comp, [&] (long b) {
+      long lo = b * block_size;
+      long hi = std::min(n, lo + block_size);
+      long offsets[1L << PSORT_RADIX_BITS];
+      long fill[1L << PSORT_RADIX_BITS] = { 0 };
+      for (long d = 0; d < nb_digits; d++) {
+        offsets[d] = counts[d * nb_blocks + b];
+      }
+      value_type* buffer = buffers.mine();
+      for (long i = lo; i < hi; i++) {
+        long d = digit_of(src[i]);
+        value_type* buf = &buffer[d * PSORT_RADIX_BUFFER];
+        buf[fill[d]++] = src[i];
+        if (fill[d] == PSORT_RADIX_BUFFER) {
+          std::copy(buf, buf + PSORT_RADIX_BUFFER, dst + offsets[d]);
+          offsets[d] += PSORT_RADIX_BUFFER;
+          fill[d] = 0;
+        }
+      }
+      for (long d = 0; d < nb_digits; d++) {
+        value_type* buf = &buffer[d * PSORT_RADIX_BUFFER];
+        std::copy(buf, buf + fill[d], dst + offsets[d]);
+      }
+    });
+    std::swap(src, dst);
+  }
+  if (src != xs) {
+    pmem::copy(src, src + n, xs);
+  }
+}
+  
+#define PSORT_SAMPLE_THRESHOLD 16384
+#define PSORT_SAMPLE_OVERSAMPLING 8
+#define PSORT_SAMPLE_MAX_BUCKETS 1024
+#define PSORT_SAMPLE_BLOCK 16384
+#define PSORT_SAMPLE_MAX_BLOCKS 1024
+  
+inline long sample_index(long i, long n) {
+  unsigned long h = (unsigned long)i * 0x9E3779B97F4A7C15UL;
+  h ^= h >> 29;
+  h *= 0xBF58476D1CE4E5B9UL;
+  h ^= h >> 32;
+  return (long)(h % (unsigned long)n);
+}
+  
+/* Sample sort of [xs, xs + n), using [tmp, tmp + n) as scratch space.
+ * Splitters are picked from a sorted random sample of the input. Each
+ * block of the input computes the bucket of each of its items and
+ * counts the items per bucket; the counts are scanned in bucket-major
+ * order, which gives every block its destination in each bucket, and
+ * the items are then moved to their buckets in tmp. Finally, the
+ * buckets are sorted in parallel, recursively if they are large, and
+ * copied back to xs, so that every item is moved about twice.
+ *
+ * A key that is frequent enough to be picked as several consecutive
+ * splitters gets a bucket of its own: the items equal to it go to the
+ * bucket between two of these equal splitters, which would otherwise
+ * be empty, and this bucket needs no sorting. Heavy duplicates thus
+ * make the recursion shallower instead of deeper.
+ */
+template <class Iter, class Compare>
+void samplesort_rng(Iter xs, Iter tmp, long n, const Compare& compare) {
+  using value_type = typename std::iterator_traits<Iter>::value_type;
+  if (n < PSORT_SAMPLE_THRESHOLD) {
+    std::sort(xs, xs + n, compare);
+    return;
+  }
+  long nb_buckets = std::min((long)PSORT_SAMPLE_MAX_BUCKETS, (long)std::sqrt((double)n) / 4);
+  long block_size = std::max((long)PSORT_SAMPLE_BLOCK, (n + PSORT_SAMPLE_MAX_BLOCKS - 1) / PSORT_SAMPLE_MAX_BLOCKS);
+  long nb_blocks = (n + block_size - 1) / block_size;
+  auto block_comp = [&] (long l, long r) {
+    return (r - l) * block_size;
   };
-  auto convert_reduce = [&] (input_type& in, result_type& dst) {
-    if (in.hi-in.lo > 1){
-      std::sort(xs+in.lo, xs+in.hi, compare);
+  parray<value_type> sample(nb_buckets * PSORT_SAMPLE_OVERSAMPLING, [&] (long i) {
+    return xs[sample_index(i, n)];
+  });
+  std::sort(sample.begin(), sample.end(), compare);
+  parray<value_type> splitters(nb_buckets - 1, [&] (long k) {
+    return sample[(k + 1) * PSORT_SAMPLE_OVERSAMPLING];
+  });
+  // equal_bucket[k] holds if bucket k lies between two equal splitters
+  parray<bool> equal_bucket(nb_buckets, [&] (long k) {
+    return (k >= 1) && (k + 1 < nb_buckets) && ! compare(splitters[k - 1], splitters[k]);
+  });
+  // same as std::upper_bound on the splitters, but without branches
+  // depending on the outcome of the comparisons, which are unpredictable
+  auto bucket_of = [&] (const value_type& x) {
+    const value_type* base = splitters.cbegin();
+    long len = nb_buckets - 1;
+    while (len > 1) {
+      long half = len / 2;
+      base = compare(x, base[half]) ? base : base + half;
+      len -= half;
     }
-    dst = std::make_pair(in.lo, in.hi);
+    long k = (base - splitters.cbegin()) + ((compare(x, *base)) ? 0 : 1);
+    // here, splitters[k - 1] <= x, so x is equal to it if not larger
+    if (k >= 2 && equal_bucket[k - 1] && ! compare(splitters[k - 1], x)) {
+      k--;
+    }
+    return k;
   };
-  auto seq_convert_reduce = convert_reduce;
-  level4::reduce(in, out, id, dst, convert_reduce_comp, convert_reduce, seq_convert_reduce);
-  assert(dst.first == lo);
-  assert(dst.second == hi);
+  // counts[k * nb_blocks + b] is the number of items of block b in bucket k
+  parray<long> counts(nb_buckets * nb_blocks);
+  parray<unsigned short> buckets(n);
+  range::parallel_for(0L, nb_blocks, block_comp, [&] (long b) {
+    long lo = b * block_size;
+    long hi = std::min(n, lo + block_size);
+    long c[PSORT_SAMPLE_MAX_BUCKETS] = { 0 };
+    for (long i = lo; i < hi; i++) {
+      long k = bucket_of(xs[i]);
+      buckets[i] = (unsigned short)k;
+      c[k]++;
+    }
+    for (long k = 0; k < nb_buckets; k++) {
+      counts[k * nb_blocks + b] = c[k];
+    }
+  });
+  dps::scan(counts.begin(), counts.end(), 0L, [&] (long x, long y) {
+    return x + y;
+  }, counts.begin(), forward_exclusive_scan);
+  range::parallel_for(0L, nb_blocks, block_comp, [&] (long b) {
+    long lo = b * block_size;
+    long hi = std::min(n, lo + block_size);
+    long offsets[PSORT_SAMPLE_MAX_BUCKETS];
+    for (long k = 0; k < nb_buckets; k++) {
+      offsets[k] = counts[k * nb_blocks + b];
+    }
+    for (long i = lo; i < hi; i++) {
+      tmp[offsets[buckets[i]]++] = xs[i];
+    }
+  });
+  parray<long> bucket_offsets(nb_buckets + 1, [&] (long k) {
+    return (k == nb_buckets) ? n : counts[k * nb_blocks];
+  });
+  auto sort_bucket = [&] (long k) {
+    long lo = bucket_offsets[k];
+    long hi = bucket_offsets[k + 1];
+    if (equal_bucket[k]) {
+      // all items of the bucket are equal
+    } else if (hi - lo == n) {
+      // the sample did not split the input, so recursing would not progress
+      mergesort_rng(tmp + lo, xs + lo, 0L, hi - lo, compare);
+    } else {
+      samplesort_rng(tmp + lo, xs + lo, hi - lo, compare);
+    }
+    std::copy(tmp + lo, tmp + hi, xs + lo);
+  };
+  segmented_for(bucket_offsets.cbegin(), bucket_offsets.cend(), sort_bucket, [&] (long lo, long hi) {
+    for (long k = lo; k < hi; k++) {
+      sort_bucket(k);
+    }
+  });
+}
+  
+template <class Item>
+class quicksort_contr {
+public:
+  static controller_type contr;
+};
+
+template <class Item>
+controller_type quicksort_contr<Item>::contr("quicksort"+sota<Item>());
+  
+/* In-place quicksort. The pivot is the median of three items, and the
+ * range is split by the parallel `partition`. When the items smaller
+ * than the pivot are few, the items equal to the pivot are split off
+ * by a second partition, so that many duplicates do not make the
+ * recursion degenerate. As in introsort, each level of the recursion
+ * spends one unit of `depth`, and a range that reaches depth zero is
+ * heapsorted in place, so that inputs that defeat the median of three
+ * cost O(n log n) work and O(log n) nested calls.
+ */
+template <class Iter, class Compare>
+void quicksort_rec(Iter lo, Iter hi, long depth, const Compare& compare) {
+  using value_type = typename std::iterator_traits<Iter>::value_type;
+  using controller_type = quicksort_contr<value_type>;
+  long n = hi - lo;
+#ifdef MANUAL_CONTROL
+  if (n < PSORT_THRESHOLD) {
+    std::sort(lo, hi, compare);
+    return;
+  }
+#endif
+  par::cstmt(controller_type::contr, [&] { return sort_complexity(n); }, [&] {
+    if (n < 3) {
+      std::sort(lo, hi, compare);
+      return;
+    }
+    if (depth == 0) {
+      std::make_heap(lo, hi, compare);
+      std::sort_heap(lo, hi, compare);
+      return;
+    }
+    const value_type& a = lo[0];
+    const value_type& b = lo[n / 2];
+    const value_type& c = lo[n - 1];
+    value_type pivot = compare(a, b)
+      ? (compare(b, c) ? b : (compare(a, c) ? c : a))
+      : (compare(a, c) ? a : (compare(b, c) ? c : b));
+    Iter mid1 = pasl::pctl::partition(lo, hi, [&] (const value_type& x) {
+      return compare(x, pivot);
+    });
+    Iter mid2 = mid1;
+    if (mid1 - lo < n / 16) {
+      mid2 = pasl::pctl::partition(mid1, hi, [&] (const value_type& x) {
+        return ! compare(pivot, x);
+      });
+    }
+    par::fork2([&] {
+      quicksort_rec(lo, mid1, depth - 1, compare);
+    }, [&] {
+      quicksort_rec(mid2, hi, depth - 1, compare);
+    });
+  }, [&] {
+    std::sort(lo, hi, compare);
+  });
+}
+  
+template <class Item>
+Item radix_identity_key(const Item& x) {
+  return x;
+}
+  
+// holds if sorting with `Compare` is the same as radix sorting the items
+template <class Item, class Compare>
+class use_radix_sort : public std::false_type { };
+  
+template <class Item>
+class use_radix_sort<Item, std::less<Item>>
+  : public std::integral_constant<bool, std::is_integral<Item>::value && ! std::is_same<Item, bool>::value> { };
+  
+template <class Iter, class Compare>
+void sort_rng(Iter lo, Iter hi, Iter tmp_lo, const Compare& compare,
+              sort_engine_type engine, std::false_type) {
+  if (engine == samplesort_engine) {
+    samplesort_rng(lo, tmp_lo, hi - lo, compare);
+  } else {
+    mergesort_rng(lo, tmp_lo, 0L, hi - lo, compare);
+  }
+}
+  
+template <class Iter, class Compare>
+void sort_rng(Iter lo, Iter hi, Iter tmp_lo, const Compare&,
+              sort_engine_type, std::true_type) {
+  using value_type = typename std::iterator_traits<Iter>::value_type;
+  radix_sort_rng(lo, tmp_lo, hi - lo, &radix_identity_key<value_type>);
 }
   
 } // end namespace
@@ -372,17 +1047,1012 @@ void merge(Input_iter first1,
   merge_par(first1, first2, d_first, lo_xs, hi_xs, lo_ys, hi_ys, lo_tmp, compare);
 }
   
+namespace dps {
+template <class Iter, class Compare>
+void mergesort(Iter lo, Iter hi, Iter tmp_lo, const Compare& compare);
+}
+  
 template <class Iter, class Compare>
 void mergesort(Iter lo, Iter hi, const Compare& compare) {
   using value_type = typename std::iterator_traits<Iter>::value_type;
   long n = hi - lo;
   parray<value_type> tmp(n);
-  mergesort(lo, tmp.begin(), 0L, n, compare);
+  dps::mergesort(lo, hi, tmp.begin(), compare);
+}
+  
+namespace dps {
+template <class Iter, class Compare>
+void sort(Iter lo, Iter hi, Iter tmp_lo, const Compare& compare,
+          sort_engine_type engine = mergesort_engine);
+}
+  
+/* Sorts the items of [lo, hi) in place: besides the input, the space
+ * used is O(B + log n), for the B blocks handled by `partition` and
+ * the recursion, whose depth is at most 2 log2(n).
+ */
+template <class Iter, class Compare>
+void quicksort(Iter lo, Iter hi, const Compare& compare) {
+  quicksort_rec(lo, hi, 2 * (long)log2_of(hi - lo), compare);
+}
+  
+/* Stable sort that runs in linear time on sorted input, and in
+ * O(n log k) time on input made of k ascending or strictly descending
+ * runs.
+ */
+template <class Iter, class Compare>
+void natural_mergesort(Iter lo, Iter hi, const Compare& compare) {
+  using value_type = typename std::iterator_traits<Iter>::value_type;
+  long n = hi - lo;
+  parray<value_type> tmp(n);
+  natural_mergesort_rng(lo, tmp.begin(), n, compare);
+}
+  
+template <class Iter, class Compare>
+void samplesort(Iter lo, Iter hi, const Compare& compare) {
+  using value_type = typename std::iterator_traits<Iter>::value_type;
+  long n = hi - lo;
+  parray<value_type> tmp(n);
+  samplesort_rng(lo, tmp.begin(), n, compare);
 }
   
+/* Uses the radix sort when `compare` is `std::less` on an integral
+ * type, and otherwise the comparison sort selected by `engine`.
+ */
 template <class Iter, class Compare>
-void sort(Iter lo, Iter hi, const Compare& compare) {
-  mergesort(lo, hi, compare);
+void sort(Iter lo, Iter hi, const Compare& compare,
+          sort_engine_type engine = mergesort_engine) {
+  using value_type = typename std::iterator_traits<Iter>::value_type;
+  long n = hi - lo;
+  parray<value_type> tmp(n);
+  dps::sort(lo, hi, tmp.begin(), compare, engine);
+}
+  
+/* Sorts the items of [lo, hi) by the integral keys returned by
+ * `key_of`. The sort is stable.
+ */
+template <class Iter, class Key_of>
+void radix_sort(Iter lo, Iter hi, const Key_of& key_of) {
+  using value_type = typename std::iterator_traits<Iter>::value_type;
+  long n = hi - lo;
+  parray<value_type> tmp(n);
+  radix_sort_rng(lo, tmp.begin(), n, key_of);
+}
+
+template <class Iter>
+void radix_sort(Iter lo, Iter hi) {
+  using value_type = typename std::iterator_traits<Iter>::value_type;
+  radix_sort(lo, hi, &radix_identity_key<value_type>);
+}
+  
+template <class Iter>
+void integersort(Iter lo, Iter hi) {
+  radix_sort(lo, hi);
+}
+  
+namespace dps {
+  
+template <
+  class Input_iter,
+  class Output_iter,
+  class Compare
+>
+void merge(Input_iter first1,
+           Input_iter last1,
+           Input_iter first2,
+           Input_iter last2,
+           Output_iter d_first,
+           const Compare& compare) {
+  pasl::pctl::merge(first1, last1, first2, last2, d_first, compare);
+}
+  
+/* Same as `mergesort(lo, hi, compare)`, but uses the caller-provided
+ * range [tmp_lo, tmp_lo + (hi - lo)) as scratch space instead of
+ * allocating it.
+ */
+template <class Iter, class Compare>
+void mergesort(Iter lo, Iter hi, Iter tmp_lo, const Compare& compare) {
+  long n = hi - lo;
+  if (pasl::pctl::is_sorted(lo, hi, compare)) {
+    return;
+  }
+  mergesort_rng(lo, tmp_lo, 0L, n, compare);
+}
+  
+template <class Iter, class Compare>
+void natural_mergesort(Iter lo, Iter hi, Iter tmp_lo, const Compare& compare) {
+  natural_mergesort_rng(lo, tmp_lo, hi - lo, compare);
+}
+
+template <class Iter, class Compare>
+void samplesort(Iter lo, Iter hi, Iter tmp_lo, const Compare& compare) {
+  samplesort_rng(lo, tmp_lo, hi - lo, compare);
+}
+
+template <class Iter, class Compare>
+void sort(Iter lo, Iter hi, Iter tmp_lo, const Compare& compare,
+          sort_engine_type engine) {
+  using value_type = typename std::iterator_traits<Iter>::value_type;
+  if (pasl::pctl::is_sorted(lo, hi, compare)) {
+    return;
+  }
+  sort_rng(lo, hi, tmp_lo, compare, engine, use_radix_sort<value_type, Compare>());
+}
+  
+/* Same as `radix_sort(lo, hi, key_of)`, but uses the caller-provided
+ * range [tmp_lo, tmp_lo + (hi - lo)) as scratch space.
+ */
+template <class Iter, class Key_of>
+void radix_sort(Iter lo, Iter hi, Iter tmp_lo, const Key_of& key_of) {
+  radix_sort_rng(lo, tmp_lo, hi - lo, key_of);
+}
+
+template <class Iter>
+void radix_sort(Iter lo, Iter hi, Iter tmp_lo) {
+  using value_type = typename std::iterator_traits<Iter>::value_type;
+  radix_sort_rng(lo, tmp_lo, hi - lo, &radix_identity_key<value_type>);
+}
+  
+} // end namespace
+  
+/*---------------------------------------------------------------------*/
+/* Sorting by key */
+  
+namespace {
+  
+/* Moves the items of [values_lo, values_lo + n) to the order given by
+ * the sorted key-index pairs: position i receives the item that was at
+ * position xs[i].second.
+ */
+template <class Pair, class Iter>
+void sort_by_key_gather(const Pair* xs, long n, Iter values_lo) {
+  using value_type = typename std::iterator_traits<Iter>::value_type;
+  parray<value_type> tmp(n, [&] (long i) {
+    return values_lo[xs[i].second];
+  });
+  pmem::copy(tmp.begin(), tmp.end(), values_lo);
+}
+  
+template <class Pair>
+void sort_by_key_gather_all(const Pair*, long) { }
+
+template <class Pair, class Iter, class... Iters>
+void sort_by_key_gather_all(const Pair* xs, long n, Iter values_lo, Iters... rest) {
+  sort_by_key_gather(xs, n, values_lo);
+  sort_by_key_gather_all(xs, n, rest...);
+}
+  
+template <class Pair, class Compare>
+void sort_pairs_by_key(Pair* xs, Pair* tmp, long n, const Compare& compare, bool stable, std::false_type) {
+  if (stable) {
+    // the indices are distinct, so breaking ties by index makes any sort stable
+    sort_rng(xs, xs + n, tmp, [&] (const Pair& x, const Pair& y) {
+      if (compare(x.first, y.first)) {
+        return true;
+      }
+      if (compare(y.first, x.first)) {
+        return false;
+      }
+      return x.second < y.second;
+    }, mergesort_engine, std::false_type());
+  } else {
+    sort_rng(xs, xs + n, tmp, [&] (const Pair& x, const Pair& y) {
+      return compare(x.first, y.first);
+    }, mergesort_engine, std::false_type());
+  }
+}
+  
+// the radix sort is stable by itself
+template <class Pair, class Compare>
+void sort_pairs_by_key(Pair* xs, Pair* tmp, long n, const Compare&, bool, std::true_type) {
+  radix_sort_rng(xs, tmp, n, [&] (const Pair& x) {
+    return x.first;
+  });
+}
+  
+/* Sorts the keys of [keys_lo, keys_lo + n) paired with their indices,
+ * writes the sorted keys back, and then gathers each payload sequence
+ * by the sorted indices.
+ */
+template <class Index, class Key_iter, class Compare, class Use_radix, class... Value_iters>
+void sort_by_key_idx(Key_iter keys_lo, long n, const Compare& compare, bool stable, Use_radix use_radix,
+                     Value_iters... values_lo) {
+  using key_type = typename std::iterator_traits<Key_iter>::value_type;
+  using pair_type = std::pair<key_type, Index>;
+  parray<pair_type> xs(n, [&] (long i) {
+    return pair_type(keys_lo[i], (Index)i);
+  });
+  {
+    parray<pair_type> tmp(n);
+    sort_pairs_by_key(xs.begin(), tmp.begin(), n, compare, stable, use_radix);
+  }
+  range::parallel_for(0L, n, [&] (long l, long r) { return r - l; }, [&] (long i) {
+    keys_lo[i] = xs[i].first;
+  });
+  sort_by_key_gather_all(xs.begin(), n, values_lo...);
+}
+  
+template <class Key_iter, class Compare, class Use_radix, class... Value_iters>
+void sort_by_key_narrow(Key_iter keys_lo, long n, const Compare& compare, bool stable, Use_radix use_radix,
+                        std::false_type, Value_iters... values_lo) {
+  sort_by_key_idx<uint64_t>(keys_lo, n, compare, stable, use_radix, values_lo...);
+}
+  
+template <class Key_iter, class Compare, class Use_radix, class... Value_iters>
+void sort_by_key_narrow(Key_iter keys_lo, long n, const Compare& compare, bool stable, Use_radix use_radix,
+                        std::true_type, Value_iters... values_lo) {
+  if (n <= (long)std::numeric_limits<uint32_t>::max()) {
+    sort_by_key_idx<uint32_t>(keys_lo, n, compare, stable, use_radix, values_lo...);
+  } else {
+    sort_by_key_idx<uint64_t>(keys_lo, n, compare, stable, use_radix, values_lo...);
+  }
+}
+  
+/* Uses 32-bit indices only when they make the key-index pairs smaller,
+ * that is, for keys of at most 4 bytes; on larger keys, the padding of
+ * the pair absorbs the difference.
+ */
+template <class Key_iter, class Compare, class Use_radix, class... Value_iters>
+void sort_by_key_rng(Key_iter keys_lo, Key_iter keys_hi, const Compare& compare, bool stable, Use_radix use_radix,
+                     Value_iters... values_lo) {
+  using key_type = typename std::iterator_traits<Key_iter>::value_type;
+  using narrow_type = std::integral_constant<bool,
+    (sizeof(std::pair<key_type, uint32_t>) < sizeof(std::pair<key_type, uint64_t>))>;
+  long n = keys_hi - keys_lo;
+  if (pasl::pctl::is_sorted(keys_lo, keys_hi, compare)) {
+    return;
+  }
+  sort_by_key_narrow(keys_lo, n, compare, stable, use_radix, narrow_type(), values_lo...);
+}
+  
+} // end namespace
+  
+/* Sorts the keys of [keys_lo, keys_hi), and applies the same
+ * permutation to each of the payload sequences that start at
+ * `values_lo...`. Only the keys and their indices are moved while
+ * sorting; each payload item is then moved once. The order of items
+ * with equal keys is not guaranteed to be preserved.
+ */
+template <class Key_iter, class Compare, class... Value_iters>
+void sort_by_key(Key_iter keys_lo, Key_iter keys_hi, const Compare& compare, Value_iters... values_lo) {
+  using key_type = typename std::iterator_traits<Key_iter>::value_type;
+  sort_by_key_rng(keys_lo, keys_hi, compare, false, use_radix_sort<key_type, Compare>(), values_lo...);
+}
+  
+template <class Key_iter, class Compare, class... Value_iters>
+void stable_sort_by_key(Key_iter keys_lo, Key_iter keys_hi, const Compare& compare, Value_iters... values_lo) {
+  using key_type = typename std::iterator_traits<Key_iter>::value_type;
+  sort_by_key_rng(keys_lo, keys_hi, compare, true, use_radix_sort<key_type, Compare>(), values_lo...);
+}
+  
+// sorts integral keys in ascending order by radix sort; the sort is stable
+template <class Key_iter, class... Value_iters>
+void radix_sort_by_key(Key_iter keys_lo, Key_iter keys_hi, Value_iters... values_lo) {
+  using key_type = typename std::iterator_traits<Key_iter>::value_type;
+  sort_by_key_rng(keys_lo, keys_hi, std::less<key_type>(), true, std::true_type(), values_lo...);
+}
+  
+/*---------------------------------------------------------------------*/
+/* Selection */
+  
+#define PSORT_SELECT_THRESHOLD 16384
+#define PSORT_SELECT_SAMPLE 4096
+#define PSORT_SELECT_MAX_BLOCKS 1024
+#define PSORT_TOPK_MAX_HEAP 4096
+  
+namespace {
+  
+/* Returns the item of rank k, that is, the item that would be at
+ * position k if [xs, xs + n) were sorted. Each round sorts a random
+ * sample of the input, and picks from the sample two pivots p1 and p2
+ * whose ranks in the sample bracket the rank of k. A counting pass then
+ * tells whether the item of rank k is less than p1, between p1 and p2,
+ * or greater than p2, and the items of that region are packed into a
+ * new array for the next round. With high probability, the item lies
+ * between the pivots, and the region keeps a fraction of about
+ * 2 / sqrt(PSORT_SELECT_SAMPLE) of the items. Should the pivots cover
+ * the whole input, the round is redone with a single pivot, in which
+ * case the middle region holds the items equal to the pivot.
+ */
+template <class Iter, class Compare>
+typename std::iterator_traits<Iter>::value_type select_rec(Iter xs, long n, long k, const Compare& compare) {
+  using value_type = typename std::iterator_traits<Iter>::value_type;
+  if (n <= PSORT_SELECT_THRESHOLD) {
+    std::vector<value_type> ys(xs, xs + n);
+    std::nth_element(ys.begin(), ys.begin() + k, ys.end(), compare);
+    return ys[k];
+  }
+  long s = PSORT_SELECT_SAMPLE;
+  std::vector<value_type> sample;
+  sample.reserve(s);
+  for (long i = 0; i < s; i++) {
+    sample.push_back(xs[sample_index(i, n)]);
+  }
+  std::sort(sample.begin(), sample.end(), compare);
+  long r = std::min(s - 1, (long)((double)k / (double)n * (double)s));
+  long delta = (long)std::sqrt((double)s);
+  value_type p1 = sample[std::max(0L, r - delta)];
+  value_type p2 = sample[std::min(s - 1, r + delta)];
+  // 0 for the items less than p1, 2 for the items greater than p2, 1 otherwise
+  auto region_of = [&] (const value_type& x) {
+    return compare(x, p1) ? 0 : (compare(p2, x) ? 2 : 1);
+  };
+  long block_size = std::max((long)PSORT_SELECT_THRESHOLD, (n + PSORT_SELECT_MAX_BLOCKS - 1) / PSORT_SELECT_MAX_BLOCKS);
+  long nb_blocks = (n + block_size - 1) / block_size;
+  long c0 = 0;
+  long c1 = 0;
+  auto count_regions = [&] {
+    parray<std::pair<long, long>> counts(nb_blocks, [&] (long b) {
+      long lo = b * block_size;
+      long hi = std::min(n, lo + block_size);
+      std::pair<long, long> c(0, 0);
+      for (long i = lo; i < hi; i++) {
+        int region = region_of(xs[i]);
+        c.first += (region == 0);
+        c.second += (region == 1);
+      }
+      return c;
+    });
+    c0 = 0;
+    c1 = 0;
+    for (long b = 0; b < nb_blocks; b++) {
+      c0 += counts[b].first;
+      c1 += counts[b].second;
+    }
+  };
+  count_regions();
+  if (c1 == n && compare(p1, p2)) {
+    p1 = sample[r];
+    p2 = p1;
+    count_regions();
+  }
+  int target;
+  if (k < c0) {
+    target = 0;
+  } else if (k < c0 + c1) {
+    if (! compare(p1, p2)) {
+      return p1;
+    }
+    target = 1;
+    k -= c0;
+  } else {
+    target = 2;
+    k -= c0 + c1;
+  }
+  parray<value_type> ys;
+  __priv::pack_if(n, [&] (long i) {
+    return region_of(xs[i]) == target;
+  }, [&] (long m) {
+    ys.prefix_tabulate(m, 0);
+    return ys.begin();
+  }, [&] (long i) {
+    return xs[i];
+  });
+  return select_rec(ys.begin(), ys.size(), k, compare);
+}
+  
+// per-worker heaps of candidates for the k smallest items
+template <class Item, class Compare>
+class top_k_heaps {
+public:
+  
+  using heaps_type = perworker::array<std::vector<Item>*, perworker::get_my_id>;
+  
+  long k;
+  const Compare& compare;
+  heaps_type heaps;
+  
+  top_k_heaps(long k, const Compare& compare)
+  : k(k), compare(compare), heaps(nullptr) { }
+  
+  ~top_k_heaps() {
+    heaps.iterate([&] (std::vector<Item>*& h) {
+      if (h != nullptr) {
+        delete h;
+        h = nullptr;
+      }
+    });
+  }
+  
+  // heap of the calling worker, allocated on first use
+  std::vector<Item>& mine() {
+    std::vector<Item>*& h = heaps.mine();
+    if (h == nullptr) {
+      h = new std::vector<Item>();
+      h->reserve(k);
+    }
+    return *h;
+  }
+  
+  /* The top of the heap is its largest item, so that an item enters a
+   * full heap only if it is less than the top, in which case it
+   * replaces the top.
+   */
+  void insert(std::vector<Item>& heap, const Item& x) {
+    if ((long)heap.size() < k) {
+      heap.push_back(x);
+      std::push_heap(heap.begin(), heap.end(), compare);
+    } else if (compare(x, heap.front())) {
+      std::pop_heap(heap.begin(), heap.end(), compare);
+      heap.back() = x;
+      std::push_heap(heap.begin(), heap.end(), compare);
+    }
+  }
+  
+};
+  
+/* Returns the contents of the heaps in which the workers collected the
+ * k smallest items of the parts of [xs, xs + n) that they visited. On
+ * input in random order, an item enters the heap of a worker that has
+ * already visited m items with probability about k / m, so that few
+ * items other than the first k seen by each worker ever enter a heap.
+ */
+template <class Iter, class Compare>
+parray<typename std::iterator_traits<Iter>::value_type> top_k_candidates(Iter xs, long n, long k, const Compare& compare) {
+  using value_type = typename std::iterator_traits<Iter>::value_type;
+  top_k_heaps<value_type, Compare> heaps(k, compare);
+  auto seq_body_rng = [&] (long lo, long hi) {
+    std::vector<value_type>& heap = heaps.mine();
+    for (long i = lo; i < hi; i++) {
+      heaps.insert(heap, xs[i]);
+    }
+  };
+  range::parallel_for(0L, n, [&] (long lo, long hi) { return hi - lo; }, [&] (long i) {
+    seq_body_rng(i, i + 1);
+  }, seq_body_rng);
+  // only the workers that took part in the loop contribute candidates
+  std::vector<std::vector<value_type>*> used;
+  heaps.heaps.iterate([&] (std::vector<value_type>* h) {
+    if (h != nullptr) {
+      used.push_back(h);
+    }
+  });
+  parray<long> offsets(used.size() + 1, [&] (long i) {
+    return (i < (long)used.size()) ? (long)used[i]->size() : 0L;
+  });
+  long m = dps::scan(offsets.begin(), offsets.end(), 0L, [&] (long x, long y) {
+    return x + y;
+  }, offsets.begin(), forward_exclusive_scan);
+  parray<value_type> candidates(m);
+  for (long i = 0; i < (long)used.size(); i++) {
+    std::copy(used[i]->begin(), used[i]->end(), candidates.begin() + offsets[i]);
+  }
+  return candidates;
+}
+  
+} // end namespace
+  
+/* Rearranges the items of [lo, hi) so that the item at `nth` is the
+ * one that would be there if the range were sorted, no item before
+ * `nth` is greater than it, and no item after `nth` is less than it.
+ * The expected work is linear.
+ */
+template <class Iter, class Compare>
+void nth_element(Iter lo, Iter nth, Iter hi, const Compare& compare) {
+  using value_type = typename std::iterator_traits<Iter>::value_type;
+  long n = hi - lo;
+  if (n <= 1 || nth == hi) {
+    return;
+  }
+  if (n <= PSORT_SELECT_THRESHOLD) {
+    // in place, without the copy made by select_rec and the two partitions
+    std::nth_element(lo, nth, hi, compare);
+    return;
+  }
+  value_type x = select_rec(lo, n, nth - lo, compare);
+  Iter mid = pasl::pctl::partition(lo, hi, [&] (const value_type& y) {
+    return compare(y, x);
+  });
+  pasl::pctl::partition(mid, hi, [&] (const value_type& y) {
+    return ! compare(x, y);
+  });
+}
+  
+/* Rearranges the items of [lo, hi) so that [lo, mid) holds the
+ * smallest mid - lo items, in sorted order. The order of the items of
+ * [mid, hi) is unspecified.
+ */
+template <class Iter, class Compare>
+void partial_sort(Iter lo, Iter mid, Iter hi, const Compare& compare) {
+  if (mid == lo) {
+    return;
+  }
+  pasl::pctl::nth_element(lo, mid - 1, hi, compare);
+  pasl::pctl::sort(lo, mid, compare);
+}
+  
+/* Returns the k smallest items of [lo, hi), in sorted order, without
+ * modifying the input. For small k, each worker collects the k smallest
+ * items it visits in a heap, and the selection runs on the candidates
+ * of all workers. Otherwise, the item of rank k - 1 is
+ * selected, and the items that are not greater than it are packed.
+ */
+template <class Iter, class Compare>
+parray<typename std::iterator_traits<Iter>::value_type> top_k(Iter lo, Iter hi, long k, const Compare& compare) {
+  using value_type = typename std::iterator_traits<Iter>::value_type;
+  long n = hi - lo;
+  k = std::max(0L, std::min(k, n));
+  if (k == 0) {
+    return parray<value_type>();
+  }
+  parray<value_type> candidates;
+  if (k <= PSORT_TOPK_MAX_HEAP) {
+    candidates = top_k_candidates(lo, n, k, compare);
+  } else {
+    value_type x = select_rec(lo, n, k - 1, compare);
+    __priv::pack_if(n, [&] (long i) {
+      return ! compare(x, lo[i]);
+    }, [&] (long m) {
+      candidates.prefix_tabulate(m, 0);
+      return candidates.begin();
+    }, [&] (long i) {
+      return lo[i];
+    });
+  }
+  pasl::pctl::partial_sort(candidates.begin(), candidates.begin() + k, candidates.end(), compare);
+  return parray<value_type>(candidates.begin(), candidates.begin() + k);
+}
+  
+/*---------------------------------------------------------------------*/
+/* Merging many sorted runs */
+  
+#define PSORT_KWAY_BLOCK 65536
+#define PSORT_KWAY_MAX_PIECES 1024
+  
+namespace {
+  
+/* Items of the runs are ordered by value, then by run, then by
+ * position in the run, which is the order of a stable merge.
+ */
+template <class Run_iter, class Compare>
+class kway_order {
+public:
+  
+  const parray<Run_iter>& runs;
+  const Compare& compare;
+  
+  kway_order(const parray<Run_iter>& runs, const Compare& compare)
+  : runs(runs), compare(compare) { }
+  
+  // number of items of run j that are ordered before the item at
+  // position p of run i, searching only in [lo, hi)
+  long count_before(long j, long lo, long hi, long i, long p) const {
+    if (j == i) {
+      return p;
+    }
+    Run_iter first = runs[j];
+    const auto& x = runs[i][p];
+    if (j < i) {
+      return std::upper_bound(first + lo, first + hi, x, compare) - first;
+    } else {
+      return std::lower_bound(first + lo, first + hi, x, compare) - first;
+    }
+  }
+  
+  bool less(long i, long p, long j, long q) const {
+    const auto& x = runs[i][p];
+    const auto& y = runs[j][q];
+    if (compare(x, y)) {
+      return true;
+    } else if (compare(y, x)) {
+      return false;
+    } else {
+      return (i < j) || (i == j && p < q);
+    }
+  }
+  
+};
+  
+/* Multi-sequence selection: writes to pos[j], for each run j, the
+ * number of items of run j among the first r items of the merge of the
+ * runs. Each step keeps, for each run, a window that contains the
+ * answer, takes as pivot the weighted median of the middle items of the
+ * windows, and shrinks all windows by comparing the rank of the pivot
+ * with r. At least a quarter of the items left in the windows is
+ * discarded at each step.
+ */
+template <class Run_iter, class Compare>
+void kway_select(const kway_order<Run_iter, Compare>& order,
+                 const parray<long>& sizes,
+                 long r,
+                 long* pos) {
+  long k = sizes.size();
+  std::vector<long> lo(k, 0);
+  std::vector<long> hi(sizes.begin(), sizes.end());
+  std::vector<long> mids;
+  mids.reserve(k);
+  while (true) {
+    mids.clear();
+    long total = 0;
+    for (long j = 0; j < k; j++) {
+      if (lo[j] < hi[j]) {
+        mids.push_back(j);
+        total += hi[j] - lo[j];
+      }
+    }
+    if (total == 0) {
+      break;
+    }
+    std::sort(mids.begin(), mids.end(), [&] (long i, long j) {
+      return order.less(i, (lo[i] + hi[i]) / 2, j, (lo[j] + hi[j]) / 2);
+    });
+    long i = mids.back();
+    long weight = 0;
+    for (long j : mids) {
+      weight += hi[j] - lo[j];
+      if (2 * weight >= total) {
+        i = j;
+        break;
+      }
+    }
+    long p = (lo[i] + hi[i]) / 2;
+    long rank = 0;
+    for (long j = 0; j < k; j++) {
+      pos[j] = order.count_before(j, lo[j], hi[j], i, p);
+      rank += pos[j];
+    }
+    if (rank < r) {
+      // the pivot and all the items before it are among the first r
+      for (long j = 0; j < k; j++) {
+        lo[j] = pos[j];
+      }
+      lo[i] = p + 1;
+    } else {
+      for (long j = 0; j < k; j++) {
+        hi[j] = pos[j];
+      }
+    }
+  }
+  for (long j = 0; j < k; j++) {
+    pos[j] = lo[j];
+  }
+}
+  
+/* Loser tree over the runs [starts[j], stops[j]), for j in [0, k).
+ * The root holds the run whose next item comes first in the merge;
+ * every inner node holds the run that lost the match at that node.
+ */
+template <class Run_iter, class Compare>
+class kway_loser_tree {
+public:
+  
+  const kway_order<Run_iter, Compare>& order;
+  std::vector<long> heads;
+  std::vector<long> stops;
+  std::vector<long> tree;
+  long k;
+  long nb_leaves;
+  
+  bool wins(long i, long j) const {
+    if (j >= k || heads[j] == stops[j]) {
+      return true;
+    } else if (i >= k || heads[i] == stops[i]) {
+      return false;
+    } else {
+      return order.less(i, heads[i], j, heads[j]);
+    }
+  }
+  
+  long build(long node) {
+    if (node >= nb_leaves) {
+      return node - nb_leaves;
+    }
+    long l = build(2 * node);
+    long r = build(2 * node + 1);
+    if (wins(l, r)) {
+      tree[node] = r;
+      return l;
+    } else {
+      tree[node] = l;
+      return r;
+    }
+  }
+  
+  kway_loser_tree(const kway_order<Run_iter, Compare>& order,
+                  const long* starts, const long* stops_, long k)
+  : order(order), heads(starts, starts + k), stops(stops_, stops_ + k), k(k) {
+    nb_leaves = 1;
+    while (nb_leaves < k) {
+      nb_leaves *= 2;
+    }
+    tree.resize(nb_leaves);
+    tree[0] = build(1);
+  }
+  
+  // returns the run of the next item in the merge, and advances it
+  long pop() {
+    long w = tree[0];
+    heads[w]++;
+    long winner = w;
+    for (long node = (w + nb_leaves) / 2; node >= 1; node /= 2) {
+      if (wins(tree[node], winner)) {
+        std::swap(tree[node], winner);
+      }
+    }
+    tree[0] = winner;
+    return w;
+  }
+  
+};
+  
+template <class Runs_iter, class Output_iter, class Compare>
+void kway_merge_rng(Runs_iter runs_lo, Runs_iter runs_hi, Output_iter dst_lo, const Compare& compare) {
+  using run_iter_type = decltype((*runs_lo).cbegin());
+  long k = runs_hi - runs_lo;
+  if (k == 0) {
+    return;
+  }
+  parray<run_iter_type> runs(k, [&] (long j) {
+    return (*(runs_lo + j)).cbegin();
+  });
+  parray<long> sizes(k, [&] (long j) {
+    return (*(runs_lo + j)).cend() - (*(runs_lo + j)).cbegin();
+  });
+  long n = 0;
+  for (long j = 0; j < k; j++) {
+    n += sizes[j];
+  }
+  using order_type = kway_order<run_iter_type, Compare>;
+  order_type order(runs, compare);
+  long block_size = std::max((long)PSORT_KWAY_BLOCK, (n + PSORT_KWAY_MAX_PIECES - 1) / PSORT_KWAY_MAX_PIECES);
+  long nb_pieces = std::max(1L, (n + block_size - 1) / block_size);
+  // cuts[c * k + j] is the number of items of run j before the c-th cut
+  parray<long> cuts((nb_pieces + 1) * k);
+  parallel_for(0L, nb_pieces + 1, [&] (long c) {
+    kway_select(order, sizes, std::min(n, c * block_size), &cuts[c * k]);
+  });
+  parallel_for(0L, nb_pieces, [&] (long c) {
+    return k + std::min(n, (c + 1) * block_size) - c * block_size;
+  }, [&] (long c) {
+    kway_loser_tree<run_iter_type, Compare> tree(order, &cuts[c * k], &cuts[(c + 1) * k], k);
+    long lo = c * block_size;
+    long hi = std::min(n, lo + block_size);
+    for (long i = lo; i < hi; i++) {
+      long j = tree.heads[tree.tree[0]];
+      *(dst_lo + i) = runs[tree.pop()][j];
+    }
+  });
+}
+  
+} // end namespace
+  
+/* Returns the stable merge of the sorted runs in [runs_lo, runs_hi),
+ * each run being a container such as a `parray`. The output is cut in
+ * pieces of equal size by multi-sequence selection, and each piece is
+ * merged with a loser tree, so that every item is moved once.
+ */
+template <class Runs_iter, class Compare>
+parray<typename value_type_of<Runs_iter>::value_type>
+kway_merge(Runs_iter runs_lo, Runs_iter runs_hi, const Compare& compare) {
+  using value_type = typename value_type_of<Runs_iter>::value_type;
+  long n = 0;
+  for (Runs_iter it = runs_lo; it != runs_hi; it++) {
+    n += (*it).size();
+  }
+  parray<value_type> dst(n);
+  kway_merge_rng(runs_lo, runs_hi, dst.begin(), compare);
+  return dst;
+}
+  
+namespace dps {
+  
+template <class Runs_iter, class Output_iter, class Compare>
+void kway_merge(Runs_iter runs_lo, Runs_iter runs_hi, Output_iter dst_lo, const Compare& compare) {
+  kway_merge_rng(runs_lo, runs_hi, dst_lo, compare);
+}
+  
+} // end namespace
+  
+/*---------------------------------------------------------------------*/
+/* Batched search in sorted arrays */
+  
+namespace {
+  
+template <class Item>
+class batch_search_contr {
+public:
+  static controller_type contr;
+};
+
+template <class Item>
+controller_type batch_search_contr<Item>::contr("batch_search"+sota<Item>());
+  
+/* Returns the position, relative to xs, that search(xs + lo, xs + hi, q)
+ * would return, in time logarithmic in the distance between lo and
+ * this position. Windows of doubling sizes are probed, starting from
+ * lo, by searching their last item only, until the answer is known to
+ * lie in a window, which is then searched in full.
+ */
+template <class Iter, class Query, class Search>
+long gallop(Iter xs, long lo, long hi, const Query& q, const Search& search) {
+  long step = 1;
+  while (lo < hi) {
+    long b = std::min(hi, lo + step);
+    if (search(xs + b - 1, xs + b, q) != xs + b) {
+      return search(xs + lo, xs + b, q) - xs;
+    }
+    lo = b;
+    step *= 2;
+  }
+  return hi;
+}
+  
+// For each j in [lo_qs, hi_qs), writes to dst[idx(j)] the position
+// returned by search(xs + lo_xs, xs + hi_xs, query(j)) relative to
+// xs, where the queries are sorted by increasing j. The middle query
+// is searched first, and its position splits both the array and the
+// remaining queries in two independent halves. Sequentially, each
+// query is searched by galloping from the answer to the previous one.
+template <
+  class Item,
+  class Iter,
+  class Query,
+  class Idx,
+  class Search
+>
+void batch_search_rec(Iter xs, long lo_xs, long hi_xs,
+                      long lo_qs, long hi_qs,
+                      const Query& query,
+                      const Idx& idx,
+                      long* dst,
+                      const Search& search) {
+  using controller_type = batch_search_contr<Item>;
+  auto seq = [&] {
+    for (long j = lo_qs; j < hi_qs; j++) {
+      lo_xs = gallop(xs, lo_xs, hi_xs, query(j), search);
+      dst[idx(j)] = lo_xs;
+    }
+  };
+#ifdef MANUAL_CONTROL
+  if (hi_qs - lo_qs < PSORT_THRESHOLD) {
+    seq();
+    return;
+  }
+#endif
+  par::cstmt(controller_type::contr, [&] { return search_complexity(hi_qs - lo_qs, hi_xs - lo_xs); }, [&] {
+    if (hi_qs - lo_qs < 2) {
+      seq();
+      return;
+    }
+    long mid_qs = (lo_qs + hi_qs) / 2;
+    long mid_xs = search(xs + lo_xs, xs + hi_xs, query(mid_qs)) - xs;
+    dst[idx(mid_qs)] = mid_xs;
+    par::fork2([&] {
+      batch_search_rec<Item>(xs, lo_xs, mid_xs, lo_qs, mid_qs, query, idx, dst, search);
+    }, [&] {
+      batch_search_rec<Item>(xs, mid_xs, hi_xs, mid_qs + 1, hi_qs, query, idx, dst, search);
+    });
+  }, seq);
+}
+  
+template <
+  class Iter,
+  class Query_iter,
+  class Search
+>
+parray<long> sorted_batch_search(Iter lo, Iter hi,
+                                 Query_iter queries_lo, Query_iter queries_hi,
+                                 const Search& search) {
+  long m = queries_hi - queries_lo;
+  parray<long> dst(m);
+  batch_search_rec<value_type_of<Query_iter>>(lo, 0L, hi - lo, 0L, m, [&] (long j) {
+    return *(queries_lo + j);
+  }, [&] (long j) {
+    return j;
+  }, dst.begin(), search);
+  return dst;
+}
+  
+template <
+  class Iter,
+  class Query_iter,
+  class Compare,
+  class Search
+>
+parray<long> batch_search(Iter lo, Iter hi,
+                          Query_iter queries_lo, Query_iter queries_hi,
+                          const Compare& compare,
+                          const Search& search) {
+  long m = queries_hi - queries_lo;
+  parray<long> order(m, [&] (long j) {
+    return j;
+  });
+  pasl::pctl::sort(order.begin(), order.end(), [&] (long i, long j) {
+    return compare(*(queries_lo + i), *(queries_lo + j));
+  });
+  parray<long> dst(m);
+  batch_search_rec<value_type_of<Query_iter>>(lo, 0L, hi - lo, 0L, m, [&] (long j) {
+    return *(queries_lo + order[j]);
+  }, [&] (long j) {
+    return order[j];
+  }, dst.begin(), search);
+  return dst;
+}
+  
+} // end namespace
+  
+/* Returns, for each query in [queries_lo, queries_hi), the position,
+ * relative to `lo`, that `std::lower_bound(lo, hi, query, compare)`
+ * would return. The range [lo, hi) must be sorted with respect to
+ * `compare`; the queries may be in any order.
+ */
+template <
+  class Iter,
+  class Query_iter,
+  class Compare
+>
+parray<long> batch_lower_bound(Iter lo, Iter hi,
+                               Query_iter queries_lo, Query_iter queries_hi,
+                               const Compare& compare) {
+  return batch_search(lo, hi, queries_lo, queries_hi, compare, [&] (Iter l, Iter r, const value_type_of<Query_iter>& q) {
+    return std::lower_bound(l, r, q, compare);
+  });
+}
+
+template <class Iter, class Query_iter>
+parray<long> batch_lower_bound(Iter lo, Iter hi, Query_iter queries_lo, Query_iter queries_hi) {
+  return batch_lower_bound(lo, hi, queries_lo, queries_hi, std::less<value_type_of<Iter>>());
+}
+  
+/* Same as `batch_lower_bound`, but with `std::upper_bound` */
+template <
+  class Iter,
+  class Query_iter,
+  class Compare
+>
+parray<long> batch_upper_bound(Iter lo, Iter hi,
+                               Query_iter queries_lo, Query_iter queries_hi,
+                               const Compare& compare) {
+  return batch_search(lo, hi, queries_lo, queries_hi, compare, [&] (Iter l, Iter r, const value_type_of<Query_iter>& q) {
+    return std::upper_bound(l, r, q, compare);
+  });
+}
+
+template <class Iter, class Query_iter>
+parray<long> batch_upper_bound(Iter lo, Iter hi, Query_iter queries_lo, Query_iter queries_hi) {
+  return batch_upper_bound(lo, hi, queries_lo, queries_hi, std::less<value_type_of<Iter>>());
+}
+  
+/* Same as `batch_lower_bound`, but assumes that the queries are
+ * already sorted with respect to `compare`, and thus skips the sorting
+ * step.
+ */
+template <
+  class Iter,
+  class Query_iter,
+  class Compare
+>
+parray<long> sorted_batch_lower_bound(Iter lo, Iter hi,
+                                      Query_iter queries_lo, Query_iter queries_hi,
+                                      const Compare& compare) {
+  return sorted_batch_search(lo, hi, queries_lo, queries_hi, [&] (Iter l, Iter r, const value_type_of<Query_iter>& q) {
+    return std::lower_bound(l, r, q, compare);
+  });
+}
+
+template <class Iter, class Query_iter>
+parray<long> sorted_batch_lower_bound(Iter lo, Iter hi, Query_iter queries_lo, Query_iter queries_hi) {
+  return sorted_batch_lower_bound(lo, hi, queries_lo, queries_hi, std::less<value_type_of<Iter>>());
+}
+  
+/* Same as `batch_upper_bound`, but assumes that the queries are
+ * already sorted with respect to `compare`
+ */
+template <
+  class Iter,
+  class Query_iter,
+  class Compare
+>
+parray<long> sorted_batch_upper_bound(Iter lo, Iter hi,
+                                      Query_iter queries_lo, Query_iter queries_hi,
+                                      const Compare& compare) {
+  return sorted_batch_search(lo, hi, queries_lo, queries_hi, [&] (Iter l, Iter r, const value_type_of<Query_iter>& q) {
+    return std::upper_bound(l, r, q, compare);
+  });
+}
+
+template <class Iter, class Query_iter>
+parray<long> sorted_batch_upper_bound(Iter lo, Iter hi, Query_iter queries_lo, Query_iter queries_hi) {
+  return sorted_batch_upper_bound(lo, hi, queries_lo, queries_hi, std::less<value_type_of<Iter>>());
 }
 
 /***********************************************************************/
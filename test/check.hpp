@@ -0,0 +1,44 @@
+/*!
+ * \file check.hpp
+ * \brief Reporting of the results of the regression checks
+ * \date 2015
+ * \copyright COPYRIGHT (c) 2015 Umut Acar, Arthur Chargueraud, and
+ * Michael Rainey. All rights reserved.
+ * \license This project is released under the GNU Public License.
+ *
+ */
+
+#include <stdio.h>
+#include <algorithm>
+#include <string>
+#include <vector>
+
+#ifndef _PCTL_CHECK_H_
+#define _PCTL_CHECK_H_
+
+namespace pasl {
+namespace pctl {
+
+/***********************************************************************/
+
+bool all_ok = true;
+
+// prints the outcome of one check, and records any failure
+void check(const std::string& name, bool ok) {
+  printf("%s %s\n", name.c_str(), ok ? "ok" : "FAILED");
+  all_ok = all_ok && ok;
+}
+
+// true if [lo, hi) holds the same items as `expected`, in the same order
+template <class Iter, class Item>
+bool same_items(Iter lo, Iter hi, const std::vector<Item>& expected) {
+  return (hi - lo == (long)expected.size())
+      && std::equal(expected.begin(), expected.end(), lo);
+}
+
+/***********************************************************************/
+
+} // end namespace
+} // end namespace
+
+#endif /*! _PCTL_CHECK_H_ */
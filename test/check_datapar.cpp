@@ -0,0 +1,562 @@
+/*!
+ * \file check_datapar.cpp
+ * \brief Regression checks for the data-parallel operations
+ * \date 2015
+ * \copyright COPYRIGHT (c) 2015 Umut Acar, Arthur Chargueraud, and
+ * Michael Rainey. All rights reserved.
+ * \license This project is released under the GNU Public License.
+ *
+ * Prints one line per check, and exits with a nonzero status if any
+ * check fails.
+ *
+ * Usage: check_datapar.opt [-n 1000]
+ */
+
+#include "example.hpp"
+#include "io.hpp"
+#include "datapar.hpp"
+#include "cmdline.hpp"
+#include "check.hpp"
+#include <algorithm>
+#include <atomic>
+#include <limits>
+#include <numeric>
+#include <string>
+
+/***********************************************************************/
+
+namespace pasl {
+  namespace pctl {
+
+    // expected result of a scan of (0, 1, ..., n-1) by addition
+    parray<long> expected_scan(long n, scan_type st) {
+      parray<long> e(n);
+      if (st == forward_exclusive_scan || st == forward_inclusive_scan) {
+        long x = 0;
+        for (long i = 0; i < n; i++) {
+          x += i;
+          e[i] = (st == forward_inclusive_scan) ? x : x - i;
+        }
+      } else {
+        long x = 0;
+        for (long i = n - 1; i >= 0; i--) {
+          x += i;
+          e[i] = (st == backward_inclusive_scan) ? x : x - i;
+        }
+      }
+      return e;
+    }
+
+    // The index passed to the lift function must be the position of
+    // the item, whatever the direction of the scan.
+    void check_scan_indices(long n) {
+      std::vector<std::pair<std::string, scan_type>> sts = {
+        { "forward_exclusive", forward_exclusive_scan },
+        { "forward_inclusive", forward_inclusive_scan },
+        { "backward_exclusive", backward_exclusive_scan },
+        { "backward_inclusive", backward_inclusive_scan },
+      };
+      parray<long> xs(n, [&] (long) {
+        return 0L;
+      });
+      auto combine = [&] (long x, long y) {
+        return x + y;
+      };
+      auto lift_idx = [&] (long i, long) {
+        return i;
+      };
+      auto lift_comp_idx = [&] (long, long) {
+        return 1L;
+      };
+      for (auto& p : sts) {
+        parray<long> e = expected_scan(n, p.second);
+        parray<long> r = level1::scani(xs.cbegin(), xs.cend(), 0L, combine, lift_idx, p.second);
+        bool ok = true;
+        for (long i = 0; i < n; i++) {
+          ok = ok && (r[i] == e[i]);
+        }
+        check("scani " + p.first, ok);
+        parray<long> w = level1::scani(xs.cbegin(), xs.cend(), 0L, combine, lift_comp_idx, lift_idx, p.second);
+        ok = true;
+        for (long i = 0; i < n; i++) {
+          ok = ok && (w[i] == e[i]);
+        }
+        check("weighted scani " + p.first, ok);
+        long id = 0L;
+        parray<long> d(n);
+        long total = dps::level1::scani(xs.cbegin(), xs.cend(), id, combine, d.begin(), lift_idx, p.second);
+        ok = (total == n * (n - 1) / 2);
+        for (long i = 0; i < n; i++) {
+          ok = ok && (d[i] == e[i]);
+        }
+        check("dps scani " + p.first, ok);
+        parray<long> dw(n);
+        total = dps::level1::scani(xs.cbegin(), xs.cend(), id, combine, dw.begin(), lift_comp_idx, lift_idx, p.second);
+        ok = (total == n * (n - 1) / 2);
+        for (long i = 0; i < n; i++) {
+          ok = ok && (dw[i] == e[i]);
+        }
+        check("dps weighted scani " + p.first, ok);
+      }
+    }
+
+    std::vector<long> sizes(long n) {
+      return { 0, 1, 2, n, 3 * DATAPAR_DETERMINISTIC_BLOCK_SIZE + 1 };
+    }
+
+    long hash(long i) {
+      return (i * 2654435761L) % 1000003;
+    }
+
+    void check_dps_max_index(long n) {
+      bool ok = true;
+      auto comp = [&] (long x, long y) {
+        return x > y;
+      };
+      for (long sz : sizes(n)) {
+        // distinct items, as max_index may return any of several
+        // maximal items
+        parray<long> xs(sz, [&] (long i) {
+          return hash(i);
+        });
+        long expected = (sz == 0) ? -1L : std::max_element(xs.cbegin(), xs.cend()) - xs.cbegin();
+        long dst = -2L;
+        dps::max_index(xs.cbegin(), xs.cend(), -1L, comp, dst);
+        ok = ok && (dst == expected);
+        dst = -2L;
+        dps::max_index(xs.cbegin(), xs.cend(), -1000003L, comp, [&] (long, long x) {
+          return -x;
+        }, dst);
+        expected = (sz == 0) ? -1L : std::min_element(xs.cbegin(), xs.cend()) - xs.cbegin();
+        ok = ok && (dst == expected);
+      }
+      check("dps max_index", ok);
+    }
+
+    // The total returned by the destination-passing scan must be the
+    // reduction of the input, even when the scan is done in place.
+    void check_deterministic_dps_scan_total(long n) {
+      std::vector<std::pair<std::string, scan_type>> sts = {
+        { "forward_exclusive", forward_exclusive_scan },
+        { "forward_inclusive", forward_inclusive_scan },
+        { "backward_exclusive", backward_exclusive_scan },
+        { "backward_inclusive", backward_inclusive_scan },
+      };
+      auto combine = [&] (long x, long y) {
+        return x + y;
+      };
+      for (auto& p : sts) {
+        bool ok = true;
+        for (long sz : sizes(n)) {
+          parray<long> xs(sz, [&] (long i) {
+            return i;
+          });
+          parray<long> e = expected_scan(sz, p.second);
+          long total = deterministic::dps::scan(xs.cbegin(), xs.cend(), 0L, combine, xs.begin(), p.second);
+          ok = ok && (total == sz * (sz - 1) / 2);
+          for (long i = 0; i < sz; i++) {
+            ok = ok && (xs[i] == e[i]);
+          }
+        }
+        check("deterministic dps scan total " + p.first, ok);
+      }
+    }
+
+    // segment sizes: no segment, empty segments only, mixed sizes with
+    // empty segments among them, a single segment, and unit segments
+    std::vector<std::vector<long>> segment_layouts(long n) {
+      std::vector<long> mixed;
+      for (long i = 0; i < n / 4; i++) {
+        mixed.push_back((i % 5 == 0) ? 0L : hash(i) % 9);
+      }
+      return {
+        { },
+        { 0, 0, 0 },
+        mixed,
+        { n },
+        std::vector<long>(n, 1L),
+      };
+    }
+
+    std::vector<long> offsets_of(const std::vector<long>& sizes) {
+      std::vector<long> offsets(1, 0L);
+      for (long s : sizes) {
+        offsets.push_back(offsets.back() + s);
+      }
+      return offsets;
+    }
+
+    void check_segmented_reduce(long n) {
+      bool ok = true;
+      bool lift_ok = true;
+      auto plus = [&] (long x, long y) {
+        return x + y;
+      };
+      // concatenation, to check the order in which the items are combined
+      auto concat = [&] (const std::string& x, const std::string& y) {
+        return x + y;
+      };
+      auto lift = [&] (long x) {
+        return std::to_string(x % 10);
+      };
+      for (auto& sizes : segment_layouts(n)) {
+        std::vector<long> offsets = offsets_of(sizes);
+        long nb_items = offsets.back();
+        parray<long> xs(nb_items, [&] (long i) {
+          return hash(i);
+        });
+        std::vector<long> expected;
+        std::vector<std::string> lift_expected;
+        for (long i = 0; i + 1 < (long)offsets.size(); i++) {
+          long r = 0;
+          std::string sr;
+          for (long j = offsets[i]; j < offsets[i + 1]; j++) {
+            r += xs[j];
+            sr += lift(xs[j]);
+          }
+          expected.push_back(r);
+          lift_expected.push_back(sr);
+        }
+        parray<long> rs = segmented_reduce(xs.cbegin(), xs.cend(), offsets.cbegin(), offsets.cend(), 0L, plus);
+        ok = ok && same_items(rs.cbegin(), rs.cend(), expected);
+        parray<std::string> srs = segmented_reduce(xs.cbegin(), xs.cend(), offsets.cbegin(), offsets.cend(),
+                                                   std::string(), concat, lift);
+        lift_ok = lift_ok && same_items(srs.cbegin(), srs.cend(), lift_expected);
+      }
+      check("segmented_reduce", ok);
+      check("segmented_reduce with lift", lift_ok);
+    }
+
+    void check_segmented_scan(long n) {
+      std::vector<std::pair<std::string, scan_type>> sts = {
+        { "forward_exclusive", forward_exclusive_scan },
+        { "forward_inclusive", forward_inclusive_scan },
+        { "backward_exclusive", backward_exclusive_scan },
+        { "backward_inclusive", backward_inclusive_scan },
+      };
+      auto plus = [&] (long x, long y) {
+        return x + y;
+      };
+      for (auto& p : sts) {
+        bool ok = true;
+        bool dps_ok = true;
+        for (auto& sizes : segment_layouts(n)) {
+          std::vector<long> offsets = offsets_of(sizes);
+          long nb_items = offsets.back();
+          parray<long> xs(nb_items, [&] (long i) {
+            return hash(i) % 100;
+          });
+          std::vector<long> expected(nb_items);
+          for (long i = 0; i + 1 < (long)offsets.size(); i++) {
+            std::vector<long> segment(xs.cbegin() + offsets[i], xs.cbegin() + offsets[i + 1]);
+            bool inclusive = (p.second == forward_inclusive_scan) || (p.second == backward_inclusive_scan);
+            if (is_backward_scan(p.second)) {
+              std::reverse(segment.begin(), segment.end());
+            }
+            std::vector<long> scanned(segment.size());
+            long x = 0;
+            for (long j = 0; j < (long)segment.size(); j++) {
+              scanned[j] = inclusive ? x + segment[j] : x;
+              x += segment[j];
+            }
+            if (is_backward_scan(p.second)) {
+              std::reverse(scanned.begin(), scanned.end());
+            }
+            std::copy(scanned.begin(), scanned.end(), expected.begin() + offsets[i]);
+          }
+          parray<long> rs = segmented_scan(xs.cbegin(), xs.cend(), offsets.cbegin(), offsets.cend(), 0L, plus, p.second);
+          ok = ok && same_items(rs.cbegin(), rs.cend(), expected);
+          // in place
+          dps::segmented_scan(xs.cbegin(), xs.cend(), offsets.cbegin(), offsets.cend(), 0L, plus, xs.begin(), p.second);
+          dps_ok = dps_ok && same_items(xs.cbegin(), xs.cend(), expected);
+        }
+        check("segmented_scan " + p.first, ok);
+        check("dps segmented_scan " + p.first, dps_ok);
+      }
+    }
+
+    void check_multi_reduce(long n) {
+      bool ok = true;
+      for (long sz : sizes(n)) {
+        parray<long> xs(sz, [&] (long i) {
+          return hash(i) % 1000 - 500;
+        });
+        auto rs = std::make_tuple(
+          make_reducer(0L, [&] (long x, long y) { return x + y; }, [&] (long x) { return x; }),
+          make_reducer(std::numeric_limits<long>::min(), [&] (long x, long y) { return std::max(x, y); },
+                       [&] (long x) { return x; }),
+          make_reducer(0L, [&] (long x, long y) { return x + y; }, [&] (long x) { return (x < 0) ? 1L : 0L; }),
+          // concatenation, to check the order in which the items are combined
+          make_reducer(std::string(), [&] (const std::string& x, const std::string& y) { return x + y; },
+                       [&] (long x) { return std::to_string(x % 10); }));
+        auto r = reduce(xs.cbegin(), xs.cend(), rs);
+        std::string expected_str;
+        for (long i = 0; i < sz; i++) {
+          expected_str += std::to_string(xs[i] % 10);
+        }
+        long expected_max = (sz == 0) ? std::numeric_limits<long>::min() : *std::max_element(xs.cbegin(), xs.cend());
+        ok = ok && (std::get<0>(r) == std::accumulate(xs.cbegin(), xs.cend(), 0L));
+        ok = ok && (std::get<1>(r) == expected_max);
+        ok = ok && (std::get<2>(r) == std::count_if(xs.cbegin(), xs.cend(), [&] (long x) { return x < 0; }));
+        ok = ok && (std::get<3>(r) == expected_str);
+      }
+      check("multi reduce", ok);
+    }
+
+    // sum of the blocks of DATAPAR_DETERMINISTIC_BLOCK_SIZE items, each
+    // summed from left to right, then of the blocks of these sums, and
+    // so on, as specified for the deterministic reduction
+    double blocked_sum(std::vector<double> xs) {
+      const long k = DATAPAR_DETERMINISTIC_BLOCK_SIZE;
+      while ((long)xs.size() > k) {
+        std::vector<double> partials;
+        for (long i = 0; i < (long)xs.size(); i += k) {
+          long j = std::min((long)xs.size(), i + k);
+          partials.push_back(std::accumulate(xs.begin() + i, xs.begin() + j, 0.0));
+        }
+        xs = partials;
+      }
+      return std::accumulate(xs.begin(), xs.end(), 0.0);
+    }
+
+    void check_deterministic(long n) {
+      bool reduce_ok = true;
+      bool sum_ok = true;
+      auto plus = [&] (long x, long y) {
+        return x + y;
+      };
+      for (long sz : sizes(n)) {
+        parray<long> xs(sz, [&] (long i) {
+          return hash(i) - 500000;
+        });
+        long expected = std::accumulate(xs.cbegin(), xs.cend(), 0L);
+        reduce_ok = reduce_ok && (deterministic::reduce(xs.cbegin(), xs.cend(), 0L, plus) == expected);
+        reduce_ok = reduce_ok && (deterministic::reduce(xs.cbegin(), xs.cend(), 0L, plus, [&] (long x) {
+          return 2 * x;
+        }) == 2 * expected);
+        // values of very different magnitudes, whose floating-point sum
+        // depends on the order of the additions
+        parray<double> ds(sz, [&] (long i) {
+          return (i % 3 == 0) ? 1e16 / (double)(i + 1) : 1.0 / (double)(hash(i) + 1);
+        });
+        std::vector<double> dv(ds.cbegin(), ds.cend());
+        sum_ok = sum_ok && (deterministic::sum(ds.cbegin(), ds.cend()) == blocked_sum(dv));
+      }
+      check("deterministic reduce", reduce_ok);
+      check("deterministic sum", sum_ok);
+      std::vector<std::pair<std::string, scan_type>> sts = {
+        { "forward_exclusive", forward_exclusive_scan },
+        { "forward_inclusive", forward_inclusive_scan },
+        { "backward_exclusive", backward_exclusive_scan },
+        { "backward_inclusive", backward_inclusive_scan },
+      };
+      for (auto& p : sts) {
+        bool ok = true;
+        for (long sz : sizes(n)) {
+          parray<long> xs(sz, [&] (long i) {
+            return i;
+          });
+          parray<long> e = expected_scan(sz, p.second);
+          parray<long> r = deterministic::scan(xs.cbegin(), xs.cend(), 0L, plus, p.second);
+          ok = ok && (r.size() == sz);
+          for (long i = 0; i < sz; i++) {
+            ok = ok && (r[i] == e[i]);
+          }
+        }
+        check("deterministic scan " + p.first, ok);
+      }
+    }
+
+    void check_find(long n) {
+      bool find_if_ok = true;
+      bool find_ok = true;
+      bool of_ok = true;
+      bool mismatch_ok = true;
+      for (long sz : sizes(n)) {
+        // a match at each of these positions, or none
+        for (long pos : { 0L, 1L, sz / 2, sz - 1, sz, (long)DATAPAR_THRESHOLD }) {
+          parray<long> xs(sz, [&] (long i) {
+            // later matches, which must not be reported
+            return (i == pos || (i > pos && i % 3 == 0)) ? 1L : 0L;
+          });
+          auto is_one = [&] (long x) {
+            return x == 1;
+          };
+          auto expected = std::find_if(xs.cbegin(), xs.cend(), is_one);
+          find_if_ok = find_if_ok && (find_if(xs.cbegin(), xs.cend(), is_one) == expected);
+          find_ok = find_ok && (pasl::pctl::find(xs.cbegin(), xs.cend(), 1L) == expected);
+          of_ok = of_ok && (any_of(xs.cbegin(), xs.cend(), is_one) == std::any_of(xs.cbegin(), xs.cend(), is_one));
+          of_ok = of_ok && (none_of(xs.cbegin(), xs.cend(), is_one) == std::none_of(xs.cbegin(), xs.cend(), is_one));
+          auto is_zero = [&] (long x) {
+            return x == 0;
+          };
+          of_ok = of_ok && (all_of(xs.cbegin(), xs.cend(), is_zero) == std::all_of(xs.cbegin(), xs.cend(), is_zero));
+          parray<long> zs(sz, 0L);
+          auto m = pasl::pctl::mismatch(xs.cbegin(), xs.cend(), zs.cbegin());
+          auto em = std::mismatch(xs.cbegin(), xs.cend(), zs.cbegin());
+          mismatch_ok = mismatch_ok && (m.first == em.first) && (m.second == em.second);
+        }
+      }
+      check("find_if", find_if_ok);
+      check("find", find_ok);
+      check("any_of, all_of and none_of", of_ok);
+      check("mismatch", mismatch_ok);
+      // a match at the front is found without visiting the whole input
+      long sz = 64 * DATAPAR_THRESHOLD;
+      parray<long> xs(sz, 1L);
+      std::atomic<long> nb_calls(0);
+      long i = find_first_index(xs.cbegin(), xs.cend(), [&] (long x) {
+        nb_calls++;
+        return x == 1;
+      });
+      check("find_first_index early exit", (i == 0) && (nb_calls.load() < sz / 2));
+    }
+
+    void check_unique(long n) {
+      bool unique_ok = true;
+      bool count_ok = true;
+      bool adjacent_ok = true;
+      bool rle_ok = true;
+      for (long sz : sizes(n)) {
+        for (long nb_values : { 1L, 2L, 1000L }) {
+          // runs of equal items, of various lengths
+          parray<long> xs(sz, [&] (long i) {
+            return hash(i / 3 + hash(i) % 2) % nb_values;
+          });
+          std::vector<long> expected(xs.cbegin(), xs.cend());
+          expected.erase(std::unique(expected.begin(), expected.end()), expected.end());
+          parray<long> us = unique(xs.cbegin(), xs.cend());
+          unique_ok = unique_ok && same_items(us.cbegin(), us.cend(), expected);
+          parray<long> dus(sz);
+          long m = dps::unique(xs.cbegin(), xs.cend(), dus.begin());
+          unique_ok = unique_ok && same_items(dus.cbegin(), dus.cbegin() + m, expected);
+          count_ok = count_ok && (unique_count(xs.cbegin(), xs.cend()) == (long)expected.size());
+          std::vector<long> differences(sz);
+          std::adjacent_difference(xs.cbegin(), xs.cend(), differences.begin());
+          parray<long> ds = adjacent_difference(xs.cbegin(), xs.cend());
+          adjacent_ok = adjacent_ok && same_items(ds.cbegin(), ds.cend(), differences);
+          parray<long> dds(sz);
+          dps::adjacent_difference(xs.cbegin(), xs.cend(), dds.begin());
+          adjacent_ok = adjacent_ok && same_items(dds.cbegin(), dds.cend(), differences);
+          std::vector<std::pair<long, long>> runs;
+          for (long i = 0; i < sz; i++) {
+            if (i == 0 || xs[i] != xs[i - 1]) {
+              runs.push_back(std::make_pair(xs[i], 0L));
+            }
+            runs.back().second++;
+          }
+          auto rle = run_length_encode(xs.cbegin(), xs.cend());
+          rle_ok = rle_ok && same_items(rle.cbegin(), rle.cend(), runs);
+        }
+      }
+      check("unique", unique_ok);
+      check("unique_count", count_ok);
+      check("adjacent_difference", adjacent_ok);
+      check("run_length_encode", rle_ok);
+    }
+
+    void check_partition(long n) {
+      bool ok = true;
+      bool stable_ok = true;
+      for (long sz : sizes(n)) {
+        // no item, few items, about half of the items, and all of them
+        for (long threshold : { 0L, 10000L, 500000L, 1000003L }) {
+          auto pred = [&] (long x) {
+            return x < threshold;
+          };
+          parray<long> xs(sz, [&] (long i) {
+            return hash(i);
+          });
+          std::vector<long> items(xs.cbegin(), xs.cend());
+          long nb_true = std::count_if(items.begin(), items.end(), pred);
+          long m = partition(xs.begin(), xs.end(), pred) - xs.begin();
+          ok = ok && (m == nb_true);
+          ok = ok && std::all_of(xs.cbegin(), xs.cbegin() + m, pred);
+          ok = ok && std::none_of(xs.cbegin() + m, xs.cend(), pred);
+          std::vector<long> permuted(xs.cbegin(), xs.cend());
+          std::sort(permuted.begin(), permuted.end());
+          std::vector<long> expected = items;
+          std::sort(expected.begin(), expected.end());
+          ok = ok && (permuted == expected);
+          parray<long> ys(sz, [&] (long i) {
+            return hash(i);
+          });
+          long sm = stable_partition(ys.begin(), ys.end(), pred) - ys.begin();
+          expected = items;
+          long em = std::stable_partition(expected.begin(), expected.end(), pred) - expected.begin();
+          stable_ok = stable_ok && (sm == em) && same_items(ys.cbegin(), ys.cend(), expected);
+        }
+      }
+      check("partition", ok);
+      check("stable_partition", stable_ok);
+    }
+
+    void check_swap_reverse_rotate(long n) {
+      bool swap_ok = true;
+      bool reverse_ok = true;
+      bool rotate_ok = true;
+      // odd and even sizes
+      std::vector<long> szs = sizes(n);
+      szs.push_back(n + 1);
+      for (long sz : szs) {
+        std::vector<long> items;
+        std::vector<long> others;
+        for (long i = 0; i < sz; i++) {
+          items.push_back(hash(i));
+          others.push_back(-i);
+        }
+        parray<long> xs(sz, [&] (long i) {
+          return items[i];
+        });
+        parray<long> ys(sz, [&] (long i) {
+          return others[i];
+        });
+        auto end = swap_ranges(xs.begin(), xs.end(), ys.begin());
+        swap_ok = swap_ok && (end == ys.end());
+        swap_ok = swap_ok && same_items(xs.cbegin(), xs.cend(), others) && same_items(ys.cbegin(), ys.cend(), items);
+        std::vector<long> reversed(items.rbegin(), items.rend());
+        reverse(ys.begin(), ys.end());
+        reverse_ok = reverse_ok && same_items(ys.cbegin(), ys.cend(), reversed);
+        for (long k : { 0L, 1L, sz / 3, sz / 2, sz - 1, sz }) {
+          k = std::max(0L, std::min(k, sz));
+          parray<long> zs(sz, [&] (long i) {
+            return items[i];
+          });
+          std::vector<long> expected = items;
+          long expected_pos = std::rotate(expected.begin(), expected.begin() + k, expected.end()) - expected.begin();
+          long pos = pasl::pctl::rotate(zs.begin(), zs.begin() + k, zs.end()) - zs.begin();
+          rotate_ok = rotate_ok && (pos == expected_pos) && same_items(zs.cbegin(), zs.cend(), expected);
+        }
+      }
+      check("swap_ranges", swap_ok);
+      check("reverse", reverse_ok);
+      check("rotate", rotate_ok);
+    }
+
+    void ex() {
+      long n = pasl::util::cmdline::parse_or_default_long("n", 1000);
+      check_scan_indices(n);
+      check_dps_max_index(n);
+      check_deterministic_dps_scan_total(n);
+      check_segmented_reduce(n);
+      check_segmented_scan(n);
+      check_multi_reduce(n);
+      check_deterministic(n);
+      check_find(n);
+      check_unique(n);
+      check_partition(n);
+      check_swap_reverse_rotate(n);
+    }
+  }
+}
+
+/*---------------------------------------------------------------------*/
+
+int main(int argc, char** argv) {
+  pbbs::launch(argc, argv, [&] {
+    pasl::pctl::ex();
+  });
+  return pasl::pctl::all_ok ? 0 : 1;
+}
+
+/***********************************************************************/
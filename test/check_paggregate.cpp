@@ -0,0 +1,211 @@
+/*!
+ * \file check_paggregate.cpp
+ * \brief Regression checks for the keyed aggregations
+ * \date 2015
+ * \copyright COPYRIGHT (c) 2015 Umut Acar, Arthur Chargueraud, and
+ * Michael Rainey. All rights reserved.
+ * \license This project is released under the GNU Public License.
+ *
+ * Compares the operations of paggregate.hpp with references computed
+ * by the standard library. Prints one line per check, and exits with a
+ * nonzero status if any check fails.
+ *
+ * Usage: check_paggregate.opt [-n 100000]
+ */
+
+#include "example.hpp"
+#include "io.hpp"
+#include "paggregate.hpp"
+#include "cmdline.hpp"
+#include "check.hpp"
+#include <algorithm>
+#include <functional>
+#include <map>
+
+/***********************************************************************/
+
+namespace pasl {
+  namespace pctl {
+
+    std::vector<long> sizes(long n) {
+      return { 0, 1, 2, 1000, n };
+    }
+
+    // keys drawn from nb_keys distinct values, in no particular order
+    parray<long> make_keys(long n, long nb_keys) {
+      return parray<long>(n, [&] (long i) {
+        return (i * 2654435761L) % nb_keys;
+      });
+    }
+
+    template <class Result>
+    std::map<long, Result> as_map(const parray<long>& keys,
+                                  const std::function<Result(long)>& value_of,
+                                  const std::function<Result(Result, Result)>& combine,
+                                  const Result& id) {
+      std::map<long, Result> m;
+      for (long i = 0; i < keys.size(); i++) {
+        auto it = m.find(keys[i]);
+        if (it == m.end()) {
+          m[keys[i]] = combine(id, value_of(i));
+        } else {
+          it->second = combine(it->second, value_of(i));
+        }
+      }
+      return m;
+    }
+
+    template <class Pairs, class Result>
+    bool same_pairs(const Pairs& kvs, const std::map<long, Result>& expected, bool by_key) {
+      std::map<long, Result> got;
+      for (long i = 0; i < kvs.size(); i++) {
+        if (by_key && i > 0 && ! (kvs[i - 1].first < kvs[i].first)) {
+          return false;
+        }
+        got[kvs[i].first] = kvs[i].second;
+      }
+      return (got == expected) && (kvs.size() == (long)expected.size());
+    }
+
+    // keys collide on purpose, to exercise the regrouping of the runs
+    // of equal hashes
+    class bad_hash {
+    public:
+      std::size_t operator()(long x) const {
+        return (std::size_t)(x % 1009);
+      }
+    };
+
+    void check_reduce_by_key(long n) {
+      bool sorted_ok = true;
+      bool ok = true;
+      bool hash_ok = true;
+      bool collide_ok = true;
+      bool map_ok = true;
+      auto plus = [] (long x, long y) {
+        return x + y;
+      };
+      for (long sz : sizes(n)) {
+        for (long nb_keys : { 1L, 7L, 1000003L }) {
+          parray<long> keys = make_keys(sz, nb_keys);
+          parray<long> values(sz, [&] (long i) {
+            return i;
+          });
+          auto expected = as_map<long>(keys, [&] (long i) { return values[i]; }, plus, 0L);
+          ok = ok && same_pairs(reduce_by_key(keys.cbegin(), keys.cend(), values.cbegin(), 0L, plus), expected, true);
+          hash_ok = hash_ok && same_pairs(hash_reduce_by_key(keys.cbegin(), keys.cend(), values.cbegin(), 0L, plus), expected, false);
+          collide_ok = collide_ok && same_pairs(hash_reduce_by_key(keys.cbegin(), keys.cend(), values.cbegin(), 0L, plus, bad_hash()), expected, false);
+          auto m = reduce_by_key_map(keys.cbegin(), keys.cend(), values.cbegin(), 0L, plus);
+          map_ok = map_ok && ((long)m.size() == (long)expected.size());
+          for (auto& kv : expected) {
+            map_ok = map_ok && (m[kv.first] == kv.second);
+          }
+          std::vector<long> sorted_keys(keys.cbegin(), keys.cend());
+          std::sort(sorted_keys.begin(), sorted_keys.end());
+          parray<long> skeys(sz, [&] (long i) {
+            return sorted_keys[i];
+          });
+          auto sexpected = as_map<long>(skeys, [&] (long) { return 1L; }, plus, 0L);
+          parray<long> ones(sz, 1L);
+          sorted_ok = sorted_ok && same_pairs(sorted_reduce_by_key(skeys.cbegin(), skeys.cend(), ones.cbegin(), 0L, plus), sexpected, true);
+        }
+      }
+      check("sorted_reduce_by_key", sorted_ok);
+      check("reduce_by_key", ok);
+      check("hash_reduce_by_key", hash_ok);
+      check("hash_reduce_by_key with collisions", collide_ok);
+      check("reduce_by_key_map", map_ok);
+    }
+
+    template <class Groups>
+    bool same_groups(const Groups& groups, const parray<long>& keys, const parray<long>& values, bool by_key) {
+      std::map<long, std::vector<long>> expected;
+      for (long i = 0; i < keys.size(); i++) {
+        expected[keys[i]].push_back(values[i]);
+      }
+      std::map<long, std::vector<long>> got;
+      for (long i = 0; i < groups.size(); i++) {
+        if (by_key && i > 0 && ! (groups[i - 1].first < groups[i].first)) {
+          return false;
+        }
+        std::vector<long> g(groups[i].second.cbegin(), groups[i].second.cend());
+        std::sort(g.begin(), g.end());
+        got[groups[i].first] = g;
+      }
+      return (got == expected) && (groups.size() == (long)expected.size());
+    }
+
+    void check_group_by(long n) {
+      bool ok = true;
+      bool hash_ok = true;
+      bool collide_ok = true;
+      for (long sz : sizes(n)) {
+        for (long nb_keys : { 1L, 7L, 1000003L }) {
+          parray<long> keys = make_keys(sz, nb_keys);
+          parray<long> values(sz, [&] (long i) {
+            return i;
+          });
+          ok = ok && same_groups(group_by(keys.cbegin(), keys.cend(), values.cbegin()), keys, values, true);
+          hash_ok = hash_ok && same_groups(hash_group_by(keys.cbegin(), keys.cend(), values.cbegin()), keys, values, false);
+          collide_ok = collide_ok && same_groups(hash_group_by(keys.cbegin(), keys.cend(), values.cbegin(), bad_hash()), keys, values, false);
+        }
+      }
+      check("group_by", ok);
+      check("hash_group_by", hash_ok);
+      check("hash_group_by with collisions", collide_ok);
+    }
+
+    // Bin counts of both strategies: the per-worker bins are used when
+    // nb_bins * nb_proc <= n, and the sort on the bins otherwise.
+    void check_histogram(long n) {
+      bool ok = true;
+      bool weighted_ok = true;
+      for (long sz : sizes(n)) {
+        for (long nb_bins : { 1L, 7L, std::max(1L, sz), 10 * sz + 1 }) {
+          parray<long> xs(sz, [&] (long i) {
+            return i;
+          });
+          auto bin_of = [&] (long x) {
+            return (x * 2654435761L) % nb_bins;
+          };
+          parray<double> ws(sz, [&] (long i) {
+            return (double)(i % 10);
+          });
+          std::vector<long> expected(nb_bins, 0L);
+          std::vector<double> wexpected(nb_bins, 0.0);
+          for (long i = 0; i < sz; i++) {
+            expected[bin_of(xs[i])]++;
+            wexpected[bin_of(xs[i])] += ws[i];
+          }
+          parray<long> h = histogram(xs.cbegin(), xs.cend(), nb_bins, bin_of);
+          ok = ok && same_items(h.cbegin(), h.cend(), expected);
+          // the weight is returned by reference
+          parray<double> wh = weighted_histogram(xs.cbegin(), xs.cend(), nb_bins, bin_of, [&] (long x) -> const double& {
+            return ws[x];
+          });
+          weighted_ok = weighted_ok && same_items(wh.cbegin(), wh.cend(), wexpected);
+        }
+      }
+      check("histogram", ok);
+      check("weighted_histogram", weighted_ok);
+    }
+
+    void ex() {
+      long n = pasl::util::cmdline::parse_or_default_long("n", 100000);
+      check_reduce_by_key(n);
+      check_group_by(n);
+      check_histogram(n);
+    }
+  }
+}
+
+/*---------------------------------------------------------------------*/
+
+int main(int argc, char** argv) {
+  pbbs::launch(argc, argv, [&] {
+    pasl::pctl::ex();
+  });
+  return pasl::pctl::all_ok ? 0 : 1;
+}
+
+/***********************************************************************/
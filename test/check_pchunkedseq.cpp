@@ -0,0 +1,164 @@
+/*!
+ * \file check_pchunkedseq.cpp
+ * \brief Regression checks for the segment-wise operations on chunked
+ * sequences
+ * \date 2015
+ * \copyright COPYRIGHT (c) 2015 Umut Acar, Arthur Chargueraud, and
+ * Michael Rainey. All rights reserved.
+ * \license This project is released under the GNU Public License.
+ *
+ * Runs the segment readers and writers, and the merges and sorts that
+ * are built on them, on chunked sequences of the chunkedseq library,
+ * and compares their results with those of the standard library.
+ * Prints one line per check, and exits with a nonzero status if any
+ * check fails.
+ *
+ * Usage: check_pchunkedseq.opt [-n 10000]
+ */
+
+#include "example.hpp"
+#include "io.hpp"
+#include "pchunkedseq.hpp"
+#include "psort.hpp"
+#include "cmdline.hpp"
+#include "check.hpp"
+#include <algorithm>
+#include <iterator>
+
+/***********************************************************************/
+
+namespace pasl {
+  namespace pctl {
+
+    // small chunks, so that short inputs span many segments
+    using small_seq_type = data::chunkedseq::bootstrapped::deque<long, 8>;
+    using seq_type = data::chunkedseq::bootstrapped::deque<long>;
+
+    std::vector<long> sizes(long n) {
+      return { 0, 1, 7, 8, 9, 17, 100, n };
+    }
+
+    long hash(long i) {
+      return (i * 2654435761L) % 1000003;
+    }
+
+    template <class Chunkedseq>
+    void check_reader_writer(const std::string& name, long n) {
+      bool ok = true;
+      for (long sz : sizes(n)) {
+        Chunkedseq xs;
+        std::vector<long> expected;
+        chunked::segment_writer<Chunkedseq> writer(xs);
+        for (long i = 0; i < sz; i++) {
+          writer.push_back(hash(i));
+          expected.push_back(hash(i));
+          ok = ok && (writer.back() == hash(i));
+        }
+        writer.flush();
+        ok = ok && same_items(xs.begin(), xs.end(), expected);
+        // stop half way, as the merges do, then read the rest
+        chunked::segment_reader<Chunkedseq> reader(xs);
+        std::vector<long> read;
+        while (! reader.empty() && (long)read.size() < sz / 2) {
+          read.push_back(reader.front());
+          reader.pop_front();
+        }
+        ok = ok && (reader.size_read() == sz / 2);
+        while (! reader.empty()) {
+          read.push_back(reader.front());
+          reader.pop_front();
+        }
+        ok = ok && (read == expected) && (reader.size_read() == sz);
+      }
+      check(name + " segment_reader and segment_writer", ok);
+    }
+
+    void check_merge(long n) {
+      bool ok = true;
+      for (long sz : sizes(n)) {
+        for (long sz2 : { 0L, 3L, sz / 3, sz }) {
+          std::vector<long> xs_items;
+          std::vector<long> ys_items;
+          for (long i = 0; i < sz; i++) {
+            xs_items.push_back(hash(i) % 50);
+          }
+          for (long i = 0; i < sz2; i++) {
+            ys_items.push_back(hash(i + sz) % 50);
+          }
+          std::sort(xs_items.begin(), xs_items.end());
+          std::sort(ys_items.begin(), ys_items.end());
+          small_seq_type xs;
+          small_seq_type ys;
+          xs.pushn_back(xs_items.data(), sz);
+          ys.pushn_back(ys_items.data(), sz2);
+          std::vector<long> expected;
+          std::merge(xs_items.begin(), xs_items.end(), ys_items.begin(), ys_items.end(),
+                     std::back_inserter(expected));
+          small_seq_type result = chunked::merge(xs, ys, std::less<long>());
+          ok = ok && same_items(result.begin(), result.end(), expected);
+        }
+      }
+      check("chunked merge", ok);
+    }
+
+    template <class Chunkedseq>
+    void check_mergesort(const std::string& name, long n) {
+      bool ok = true;
+      for (long sz : sizes(n)) {
+        for (long nb_keys : { 2L, 1000003L }) {
+          Chunkedseq xs;
+          std::vector<long> expected;
+          for (long i = 0; i < sz; i++) {
+            xs.push_back(hash(i) % nb_keys);
+            expected.push_back(hash(i) % nb_keys);
+          }
+          std::sort(expected.begin(), expected.end());
+          Chunkedseq result = chunked::mergesort(xs, std::less<long>());
+          ok = ok && same_items(result.begin(), result.end(), expected);
+        }
+      }
+      check(name + " mergesort", ok);
+    }
+
+    void check_pchunked_sort(long n) {
+      bool ok = true;
+      for (long sz : sizes(n)) {
+        // sorted, sorted but for one item, and unsorted inputs
+        for (long k = 0; k < 3; k++) {
+          pchunkedseq<long> xs(sz, [&] (long i) {
+            return (k == 2) ? hash(i) : i;
+          });
+          if (k == 1 && sz > 1) {
+            *(xs.seq.begin() + (sz - 1)) = -1;
+          }
+          std::vector<long> expected(xs.seq.begin(), xs.seq.end());
+          std::sort(expected.begin(), expected.end());
+          pchunkedseq<long> result = pchunked::sort(xs, std::less<long>());
+          ok = ok && same_items(result.seq.begin(), result.seq.end(), expected);
+        }
+      }
+      check("pchunked sort", ok);
+    }
+
+    void ex() {
+      long n = pasl::util::cmdline::parse_or_default_long("n", 10000);
+      check_reader_writer<small_seq_type>("chunk capacity 8", n);
+      check_reader_writer<seq_type>("default chunk capacity", n);
+      check_merge(n);
+      check_mergesort<small_seq_type>("chunk capacity 8", n);
+      check_mergesort<seq_type>("default chunk capacity", n);
+      check_pchunked_sort(n);
+    }
+  }
+}
+
+/*---------------------------------------------------------------------*/
+
+int main(int argc, char** argv) {
+  pbbs::launch(argc, argv, [&] {
+    pasl::pctl::ex();
+  });
+  return pasl::pctl::all_ok ? 0 : 1;
+}
+
+/***********************************************************************/
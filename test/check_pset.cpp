@@ -0,0 +1,214 @@
+/*!
+ * \file check_pset.cpp
+ * \brief Regression checks for the parallel sets and maps
+ * \date 2015
+ * \copyright COPYRIGHT (c) 2015 Umut Acar, Arthur Chargueraud, and
+ * Michael Rainey. All rights reserved.
+ * \license This project is released under the GNU Public License.
+ *
+ * Compares the containers of pset.hpp and pmap.hpp with those of the
+ * standard library on random inputs. Prints one line per check, and
+ * exits with a nonzero status if any check fails.
+ *
+ * Usage: check_pset.opt [-n 3000] [-trials 200]
+ */
+
+#include "example.hpp"
+#include "io.hpp"
+#include "pchunkedseq.hpp"
+#include "pset.hpp"
+#include "pmap.hpp"
+#include "cmdline.hpp"
+#include "check.hpp"
+#include <algorithm>
+#include <map>
+#include <random>
+#include <set>
+
+/***********************************************************************/
+
+namespace pasl {
+  namespace pctl {
+
+    template <class Container>
+    std::vector<long> keys_of(const Container& xs) {
+      return std::vector<long>(xs.cbegin(), xs.cend());
+    }
+
+    // looks up each key of `r` through the search iterator of `xs`
+    bool finds_all(pset<long>& xs, const std::vector<long>& r) {
+      bool ok = true;
+      for (long x : r) {
+        ok = ok && (xs.find(x) != xs.end()) && (*xs.find(x) == x);
+      }
+      return ok;
+    }
+
+    using kv_type = std::pair<long, long>;
+
+    template <class Container>
+    std::vector<kv_type> pairs_of(const Container& xs) {
+      return std::vector<kv_type>(xs.cbegin(), xs.cend());
+    }
+
+    std::mt19937 generator(1);
+
+    // n keys drawn from [0, k)
+    parray<long> random_keys(long n, long k) {
+      return parray<long>(n, [&] (long) {
+        return (long)(generator() % k);
+      });
+    }
+
+    /* Sizes are drawn so that both inputs are sometimes of close sizes
+     * and sometimes very unbalanced, which exercises the two ways of
+     * computing set operations.
+     */
+    long random_size(long n, int trial) {
+      return (trial % 3 == 0) ? (long)(generator() % 20) : (long)(generator() % n);
+    }
+
+    void check_batches(long n, int nb_trials) {
+      bool set_ok = true;
+      bool map_ok = true;
+      for (int trial = 0; trial < nb_trials; trial++) {
+        long k = 1 + generator() % (2 * n);
+        parray<long> xs = random_keys(random_size(n, trial + 1), k);
+        parray<long> ys = random_keys(random_size(n, trial), k);
+        pset<long> s(xs.begin(), xs.end());
+        std::set<long> rs(xs.begin(), xs.end());
+        parray<kv_type> kvs(xs.size(), [&] (long i) {
+          return std::make_pair(xs[i], 1L);
+        });
+        parray<kv_type> batch(ys.size(), [&] (long i) {
+          return std::make_pair(ys[i], 2L);
+        });
+        pmap<long, long> m(kvs.begin(), kvs.end());
+        std::map<long, long> rm;
+        for (long i = 0; i < kvs.size(); i++) {
+          rm.insert(kvs[i]);
+        }
+        if (trial % 2 == 0) {
+          s.insert_batch(ys);
+          rs.insert(ys.begin(), ys.end());
+          m.insert_batch(batch);
+          for (long i = 0; i < batch.size(); i++) {
+            rm.insert(batch[i]);
+          }
+        } else {
+          s.erase_batch(ys);
+          m.erase_batch(ys);
+          for (long i = 0; i < ys.size(); i++) {
+            rs.erase(ys[i]);
+            rm.erase(ys[i]);
+          }
+        }
+        set_ok = set_ok && (keys_of(s) == keys_of(rs));
+        map_ok = map_ok && (pairs_of(m) == pairs_of(rm));
+      }
+      check("pset insert_batch and erase_batch", set_ok);
+      check("pmap insert_batch and erase_batch", map_ok);
+    }
+
+    void check_set_operations(long n, int nb_trials) {
+      bool merge_ok = true;
+      bool intersect_ok = true;
+      bool diff_ok = true;
+      for (int trial = 0; trial < nb_trials; trial++) {
+        long k = 1 + generator() % (2 * n);
+        parray<long> xs = random_keys(random_size(n, trial + 1), k);
+        parray<long> ys = random_keys(random_size(n, trial), k);
+        std::set<long> rxs(xs.begin(), xs.end());
+        std::set<long> rys(ys.begin(), ys.end());
+        std::vector<long> r;
+        pset<long> s1(xs.begin(), xs.end());
+        pset<long> s2(ys.begin(), ys.end());
+        s1.merge(s2);
+        std::set_union(rxs.begin(), rxs.end(), rys.begin(), rys.end(), std::back_inserter(r));
+        merge_ok = merge_ok && (keys_of(s1) == r) && s2.empty() && finds_all(s1, r);
+        r.clear();
+        pset<long> s3(xs.begin(), xs.end());
+        pset<long> s4(ys.begin(), ys.end());
+        s3.intersect(s4);
+        std::set_intersection(rxs.begin(), rxs.end(), rys.begin(), rys.end(), std::back_inserter(r));
+        intersect_ok = intersect_ok && (keys_of(s3) == r) && s4.empty() && finds_all(s3, r);
+        r.clear();
+        pset<long> s5(xs.begin(), xs.end());
+        pset<long> s6(ys.begin(), ys.end());
+        s5.diff(s6);
+        std::set_difference(rxs.begin(), rxs.end(), rys.begin(), rys.end(), std::back_inserter(r));
+        diff_ok = diff_ok && (keys_of(s5) == r) && s6.empty() && finds_all(s5, r);
+      }
+      check("pset merge", merge_ok);
+      check("pset intersect", intersect_ok);
+      check("pset diff", diff_ok);
+    }
+
+    // pmap updates in place, checked against the same updates on std::map
+    void check_map_updates(long n, int nb_trials) {
+      bool upsert_ok = true;
+      bool combine_ok = true;
+      bool merge_with_ok = true;
+      for (int trial = 0; trial < nb_trials; trial++) {
+        long k = 1 + generator() % (2 * n);
+        parray<long> xs = random_keys(random_size(n, trial + 1), k);
+        parray<long> ys = random_keys(random_size(n, trial), k);
+        pmap<long, long> m1;
+        std::map<long, long> rm1;
+        for (long i = 0; i < xs.size(); i++) {
+          m1.upsert(xs[i], [&] (long& v) {
+            v += 1;
+          });
+          rm1[xs[i]] += 1;
+        }
+        upsert_ok = upsert_ok && (pairs_of(m1) == pairs_of(rm1));
+        pmap<long, long> m2;
+        std::map<long, long> rm2;
+        for (long i = 0; i < ys.size(); i++) {
+          long v = i % 10;
+          m2.insert_or_combine(std::make_pair(ys[i], v), [&] (long x, long y) {
+            return x + y;
+          });
+          rm2[ys[i]] += v;
+        }
+        combine_ok = combine_ok && (pairs_of(m2) == pairs_of(rm2));
+        // not commutative, so that swapped arguments are detected
+        auto combine = [&] (long x, long y) {
+          return x * 1000 + y;
+        };
+        m1.merge_with(m2, combine);
+        for (auto& kv : rm2) {
+          auto it = rm1.find(kv.first);
+          if (it == rm1.end()) {
+            rm1.insert(kv);
+          } else {
+            it->second = combine(it->second, kv.second);
+          }
+        }
+        merge_with_ok = merge_with_ok && (pairs_of(m1) == pairs_of(rm1)) && m2.empty();
+      }
+      check("pmap upsert", upsert_ok);
+      check("pmap insert_or_combine", combine_ok);
+      check("pmap merge_with", merge_with_ok);
+    }
+
+    void ex() {
+      long n = pasl::util::cmdline::parse_or_default_long("n", 3000);
+      int nb_trials = pasl::util::cmdline::parse_or_default_int("trials", 200);
+      check_batches(n, nb_trials);
+      check_set_operations(n, nb_trials);
+      check_map_updates(n, nb_trials);
+    }
+  }
+}
+
+/*---------------------------------------------------------------------*/
+
+int main(int argc, char** argv) {
+  pbbs::launch(argc, argv, [&] {
+    pasl::pctl::ex();
+  });
+  return pasl::pctl::all_ok ? 0 : 1;
+}
+
+/***********************************************************************/
@@ -0,0 +1,548 @@
+/*!
+ * \file check_sort.cpp
+ * \brief Regression checks for the sorting algorithms
+ * \date 2015
+ * \copyright COPYRIGHT (c) 2015 Umut Acar, Arthur Chargueraud, and
+ * Michael Rainey. All rights reserved.
+ * \license This project is released under the GNU Public License.
+ *
+ * Prints one line per check, and exits with a nonzero status if any
+ * check fails.
+ *
+ * Usage: check_sort.opt [-n 100000]
+ */
+
+#include "example.hpp"
+#include "io.hpp"
+#include "psort.hpp"
+#include "cmdline.hpp"
+#include "check.hpp"
+#include <algorithm>
+#include <cmath>
+#include <functional>
+#include <iterator>
+
+/***********************************************************************/
+
+namespace pasl {
+  namespace pctl {
+
+    long nb_negative_zeros(const parray<double>& xs) {
+      long k = 0;
+      for (long i = 0; i < xs.size(); i++) {
+        if (xs[i] == 0.0 && std::signbit(xs[i])) {
+          k++;
+        }
+      }
+      return k;
+    }
+
+    using sort_type = std::function<void(parray<double>&)>;
+
+    std::vector<std::pair<std::string, sort_type>> sorts() {
+      return {
+        { "mergesort", [] (parray<double>& xs) {
+          mergesort(xs.begin(), xs.end(), std::less<double>());
+        } },
+        { "natural_mergesort", [] (parray<double>& xs) {
+          natural_mergesort(xs.begin(), xs.end(), std::less<double>());
+        } },
+        { "quicksort", [] (parray<double>& xs) {
+          quicksort(xs.begin(), xs.end(), std::less<double>());
+        } },
+        { "samplesort", [] (parray<double>& xs) {
+          samplesort(xs.begin(), xs.end(), std::less<double>());
+        } },
+        { "sort", [] (parray<double>& xs) {
+          pasl::pctl::sort(xs.begin(), xs.end(), std::less<double>());
+        } },
+        { "sort with samplesort_engine", [] (parray<double>& xs) {
+          pasl::pctl::sort(xs.begin(), xs.end(), std::less<double>(), samplesort_engine);
+        } },
+      };
+    }
+
+    bool in_order(const parray<double>& xs) {
+      bool sorted = true;
+      for (long i = 1; i < xs.size(); i++) {
+        sorted = sorted && ! (xs[i] < xs[i - 1]);
+      }
+      return sorted;
+    }
+
+    // Sorting must permute its input: equivalent but distinct items,
+    // such as -0.0 and 0.0, must be neither duplicated nor dropped.
+    void check_signed_zeros(long n) {
+      for (auto& s : sorts()) {
+        parray<double> xs(n, [&] (long i) {
+          long h = (i * 2654435761L) % 7;
+          return (h == 0) ? -0.0 : (h == 1) ? 0.0 : (double)(h - 4);
+        });
+        long before = nb_negative_zeros(xs);
+        s.second(xs);
+        check(s.first + " signed zeros", in_order(xs) && nb_negative_zeros(xs) == before);
+      }
+    }
+
+    // inputs made of a few keys, each repeated many times
+    void check_duplicates(long n) {
+      for (auto& s : sorts()) {
+        bool ok = true;
+        for (long nb_keys : { 1, 2, 3, 100 }) {
+          parray<double> xs(n, [&] (long i) {
+            return (double)((i * 2654435761L) % nb_keys);
+          });
+          std::vector<double> expected(xs.cbegin(), xs.cend());
+          std::sort(expected.begin(), expected.end());
+          s.second(xs);
+          ok = ok && std::equal(expected.begin(), expected.end(), xs.cbegin());
+        }
+        check(s.first + " duplicates", ok);
+      }
+    }
+
+    std::vector<long> sizes(long n) {
+      return { 0, 1, 2, 1000, n };
+    }
+
+    long hash(long i) {
+      return (i * 2654435761L) % 1000003;
+    }
+
+    void check_batch_bounds(long n) {
+      bool lower_ok = true;
+      bool upper_ok = true;
+      bool sorted_ok = true;
+      for (long sz : sizes(n)) {
+        for (long nb_queries : { 0L, 1L, 100L, sz }) {
+          // duplicates in both the sorted range and the queries, and
+          // queries below and above all of the items
+          std::vector<long> items;
+          for (long i = 0; i < sz; i++) {
+            items.push_back(hash(i) % (sz / 4 + 1));
+          }
+          std::sort(items.begin(), items.end());
+          parray<long> xs(sz, [&] (long i) {
+            return items[i];
+          });
+          parray<long> qs(nb_queries, [&] (long i) {
+            return hash(i + 7) % (sz / 4 + 3) - 1;
+          });
+          std::vector<long> lower;
+          std::vector<long> upper;
+          for (long i = 0; i < nb_queries; i++) {
+            lower.push_back(std::lower_bound(items.begin(), items.end(), qs[i]) - items.begin());
+            upper.push_back(std::upper_bound(items.begin(), items.end(), qs[i]) - items.begin());
+          }
+          parray<long> l = batch_lower_bound(xs.cbegin(), xs.cend(), qs.cbegin(), qs.cend());
+          lower_ok = lower_ok && same_items(l.cbegin(), l.cend(), lower);
+          parray<long> u = batch_upper_bound(xs.cbegin(), xs.cend(), qs.cbegin(), qs.cend());
+          upper_ok = upper_ok && same_items(u.cbegin(), u.cend(), upper);
+          std::vector<long> sorted_qs(qs.cbegin(), qs.cend());
+          std::sort(sorted_qs.begin(), sorted_qs.end());
+          lower.clear();
+          upper.clear();
+          for (long q : sorted_qs) {
+            lower.push_back(std::lower_bound(items.begin(), items.end(), q) - items.begin());
+            upper.push_back(std::upper_bound(items.begin(), items.end(), q) - items.begin());
+          }
+          parray<long> sl = sorted_batch_lower_bound(xs.cbegin(), xs.cend(), sorted_qs.cbegin(), sorted_qs.cend());
+          parray<long> su = sorted_batch_upper_bound(xs.cbegin(), xs.cend(), sorted_qs.cbegin(), sorted_qs.cend());
+          sorted_ok = sorted_ok && same_items(sl.cbegin(), sl.cend(), lower) && same_items(su.cbegin(), su.cend(), upper);
+        }
+      }
+      check("batch_lower_bound", lower_ok);
+      check("batch_upper_bound", upper_ok);
+      check("sorted_batch_lower_bound and sorted_batch_upper_bound", sorted_ok);
+    }
+
+    template <class Item>
+    bool radix_sorts(const std::vector<Item>& items) {
+      std::vector<Item> expected = items;
+      std::sort(expected.begin(), expected.end());
+      long n = items.size();
+      parray<Item> xs(n, [&] (long i) {
+        return items[i];
+      });
+      radix_sort(xs.begin(), xs.end());
+      bool ok = same_items(xs.cbegin(), xs.cend(), expected);
+      parray<Item> ys(n, [&] (long i) {
+        return items[i];
+      });
+      parray<Item> tmp(n);
+      dps::radix_sort(ys.begin(), ys.end(), tmp.begin());
+      ok = ok && same_items(ys.cbegin(), ys.cend(), expected);
+      parray<Item> zs(n, [&] (long i) {
+        return items[i];
+      });
+      pasl::pctl::sort(zs.begin(), zs.end(), std::less<Item>());
+      return ok && same_items(zs.cbegin(), zs.cend(), expected);
+    }
+
+    void check_radix_sort(long n) {
+      bool ok = true;
+      bool stable_ok = true;
+      for (long sz : sizes(n)) {
+        std::vector<long> longs;
+        std::vector<long> small_longs;
+        std::vector<int> ints;
+        std::vector<unsigned long> unsigneds;
+        for (long i = 0; i < sz; i++) {
+          // negative keys, keys that differ only in their low digits,
+          // and keys that use the top bit
+          longs.push_back((hash(i) - 500000) * 1000000007L);
+          small_longs.push_back(hash(i) % 7 - 3);
+          ints.push_back((int)(hash(i) - 500000));
+          unsigneds.push_back((unsigned long)hash(i) << 43);
+        }
+        ok = ok && radix_sorts(longs) && radix_sorts(small_longs) && radix_sorts(ints) && radix_sorts(unsigneds);
+        // pairs sorted by their first component keep the order of their
+        // second component
+        using pair_type = std::pair<long, long>;
+        std::vector<pair_type> pairs;
+        for (long i = 0; i < sz; i++) {
+          pairs.push_back(pair_type(hash(i) % 10 - 5, i));
+        }
+        std::vector<pair_type> expected = pairs;
+        std::stable_sort(expected.begin(), expected.end(), [&] (const pair_type& x, const pair_type& y) {
+          return x.first < y.first;
+        });
+        parray<pair_type> xs(sz, [&] (long i) {
+          return pairs[i];
+        });
+        radix_sort(xs.begin(), xs.end(), [&] (const pair_type& x) {
+          return x.first;
+        });
+        stable_ok = stable_ok && same_items(xs.cbegin(), xs.cend(), expected);
+      }
+      check("radix_sort", ok);
+      check("radix_sort by key is stable", stable_ok);
+    }
+
+    void check_mergesort(long n) {
+      bool ok = true;
+      bool dps_ok = true;
+      // sizes around the sequential threshold and around powers of two,
+      // so that the result lands in either buffer at the leaves
+      std::vector<long> szs = sizes(n);
+      for (long sz : { (long)PSORT_THRESHOLD, 2L * PSORT_THRESHOLD, 4096L, 3L * 4096 }) {
+        szs.push_back(sz - 1);
+        szs.push_back(sz);
+        szs.push_back(sz + 1);
+      }
+      for (long sz : szs) {
+        std::vector<long> expected;
+        for (long i = 0; i < sz; i++) {
+          expected.push_back(hash(i) % (sz + 1));
+        }
+        parray<long> xs(sz, [&] (long i) {
+          return expected[i];
+        });
+        parray<long> ys(sz, [&] (long i) {
+          return expected[i];
+        });
+        std::sort(expected.begin(), expected.end());
+        mergesort(xs.begin(), xs.end(), std::less<long>());
+        ok = ok && same_items(xs.cbegin(), xs.cend(), expected);
+        parray<long> tmp(sz);
+        dps::mergesort(ys.begin(), ys.end(), tmp.begin(), std::less<long>());
+        dps_ok = dps_ok && same_items(ys.cbegin(), ys.cend(), expected);
+      }
+      check("mergesort", ok);
+      check("dps mergesort", dps_ok);
+    }
+
+    using tagged_type = std::pair<long, long>;
+
+    bool less_first(const tagged_type& x, const tagged_type& y) {
+      return x.first < y.first;
+    }
+
+    void check_merge(long n) {
+      bool ok = true;
+      for (long sz : sizes(n)) {
+        // balanced and skewed inputs
+        for (long sz2 : { 0L, 1L, sz / 100, sz }) {
+          // the second component records the input and the position of
+          // each item, so that the order of equal keys can be checked
+          std::vector<tagged_type> xs_items;
+          std::vector<tagged_type> ys_items;
+          for (long i = 0; i < sz; i++) {
+            xs_items.push_back(tagged_type(hash(i) % 100, i));
+          }
+          for (long i = 0; i < sz2; i++) {
+            ys_items.push_back(tagged_type(hash(i + sz) % 100, sz + i));
+          }
+          std::stable_sort(xs_items.begin(), xs_items.end(), less_first);
+          std::stable_sort(ys_items.begin(), ys_items.end(), less_first);
+          std::vector<tagged_type> expected;
+          std::merge(xs_items.begin(), xs_items.end(), ys_items.begin(), ys_items.end(),
+                     std::back_inserter(expected), less_first);
+          parray<tagged_type> xs(sz, [&] (long i) {
+            return xs_items[i];
+          });
+          parray<tagged_type> ys(sz2, [&] (long i) {
+            return ys_items[i];
+          });
+          parray<tagged_type> result(sz + sz2);
+          merge(xs.cbegin(), xs.cend(), ys.cbegin(), ys.cend(), result.begin(), less_first);
+          ok = ok && same_items(result.cbegin(), result.cend(), expected);
+          // the larger input second
+          expected.clear();
+          std::merge(ys_items.begin(), ys_items.end(), xs_items.begin(), xs_items.end(),
+                     std::back_inserter(expected), less_first);
+          merge(ys.cbegin(), ys.cend(), xs.cbegin(), xs.cend(), result.begin(), less_first);
+          ok = ok && same_items(result.cbegin(), result.cend(), expected);
+        }
+      }
+      check("merge is stable", ok);
+    }
+
+    void check_kway_merge(long n) {
+      bool ok = true;
+      bool dps_ok = true;
+      for (long sz : sizes(n)) {
+        for (long k : { 0L, 1L, 2L, 7L, 100L }) {
+          // runs of uneven sizes, some of them empty
+          std::vector<std::vector<tagged_type>> runs(k);
+          long pos = 0;
+          for (long j = 0; j < k; j++) {
+            long m = (j % 3 == 1) ? 0 : (hash(j) % (2 * sz / k + 1));
+            for (long i = 0; i < m; i++, pos++) {
+              runs[j].push_back(tagged_type(hash(pos) % 50, pos));
+            }
+            std::stable_sort(runs[j].begin(), runs[j].end(), less_first);
+          }
+          // equal keys come in the order of their runs, then of their
+          // positions in the runs
+          std::vector<tagged_type> expected;
+          for (auto& r : runs) {
+            expected.insert(expected.end(), r.begin(), r.end());
+          }
+          std::stable_sort(expected.begin(), expected.end(), less_first);
+          parray<tagged_type> result = kway_merge(runs.cbegin(), runs.cend(), less_first);
+          ok = ok && same_items(result.cbegin(), result.cend(), expected);
+          parray<tagged_type> dst(expected.size());
+          dps::kway_merge(runs.cbegin(), runs.cend(), dst.begin(), less_first);
+          dps_ok = dps_ok && same_items(dst.cbegin(), dst.cend(), expected);
+        }
+      }
+      check("kway_merge", ok);
+      check("dps kway_merge", dps_ok);
+    }
+
+    // Musser's median-of-3 killer: a permutation of 1, ..., sz on which
+    // the median of the first, middle and last items is always among
+    // the smallest items; odd sizes get sz appended
+    std::vector<long> median_of_3_killer(long sz) {
+      long k = sz / 2;
+      std::vector<long> xs(sz, sz);
+      for (long i = 1; i <= k; i++) {
+        if (i % 2 == 1) {
+          xs[i - 1] = i;
+          xs[i] = k + i;
+        }
+        xs[k + i - 1] = 2 * i;
+      }
+      return xs;
+    }
+
+    // inputs on which a poorly chosen pivot degrades the quicksort
+    void check_quicksort(long n) {
+      bool ok = true;
+      for (long sz : sizes(n)) {
+        std::vector<long> killer = median_of_3_killer(sz);
+        for (int k = 0; k < 5; k++) {
+          // ascending, descending, organ-pipe, random and median-of-3
+          // killer inputs
+          parray<long> xs(sz, [&] (long i) {
+            return (k == 0) ? i : (k == 1) ? sz - i : (k == 2) ? std::min(i, sz - i) : (k == 3) ? hash(i) : killer[i];
+          });
+          std::vector<long> expected(xs.cbegin(), xs.cend());
+          std::sort(expected.begin(), expected.end());
+          quicksort(xs.begin(), xs.end(), std::less<long>());
+          ok = ok && same_items(xs.cbegin(), xs.cend(), expected);
+        }
+      }
+      check("quicksort", ok);
+    }
+
+    class by_key_sort {
+    public:
+      template <class Key_iter, class Compare, class... Value_iters>
+      void operator()(Key_iter keys_lo, Key_iter keys_hi, const Compare& compare, Value_iters... values_lo) const {
+        sort_by_key(keys_lo, keys_hi, compare, values_lo...);
+      }
+    };
+
+    class by_key_stable_sort {
+    public:
+      template <class Key_iter, class Compare, class... Value_iters>
+      void operator()(Key_iter keys_lo, Key_iter keys_hi, const Compare& compare, Value_iters... values_lo) const {
+        stable_sort_by_key(keys_lo, keys_hi, compare, values_lo...);
+      }
+    };
+
+    class by_key_radix_sort {
+    public:
+      template <class Key_iter, class Compare, class... Value_iters>
+      void operator()(Key_iter keys_lo, Key_iter keys_hi, const Compare&, Value_iters... values_lo) const {
+        radix_sort_by_key(keys_lo, keys_hi, values_lo...);
+      }
+    };
+
+    // Sorts copies of `keys` by key, along with their positions and a
+    // second payload, and compares the outcome with std::stable_sort.
+    template <class Key, class Compare, class Sort>
+    bool sorts_by_key(const std::vector<Key>& keys, const Compare& compare, const Sort& sort, bool stable) {
+      long n = keys.size();
+      std::vector<long> expected(n);
+      for (long i = 0; i < n; i++) {
+        expected[i] = i;
+      }
+      std::stable_sort(expected.begin(), expected.end(), [&] (long i, long j) {
+        return compare(keys[i], keys[j]);
+      });
+      parray<Key> ks(n, [&] (long i) {
+        return keys[i];
+      });
+      parray<long> idxs(n, [&] (long i) {
+        return i;
+      });
+      parray<double> ds(n, [&] (long i) {
+        return (double)i / 2.0;
+      });
+      sort(ks.begin(), ks.end(), compare, idxs.begin(), ds.begin());
+      bool ok = true;
+      std::vector<bool> seen(n, false);
+      for (long i = 0; i < n; i++) {
+        long j = idxs[i];
+        ok = ok && (j >= 0) && (j < n) && ! seen[j];
+        if (! ok) {
+          return false;
+        }
+        seen[j] = true;
+        // the payloads move with their keys
+        ok = ok && (ks[i] == keys[j]) && (ds[i] == (double)j / 2.0);
+        // the keys are sorted
+        ok = ok && ! compare(ks[i], keys[expected[i]]) && ! compare(keys[expected[i]], ks[i]);
+        // only the unstable sort may reorder equal keys
+        ok = ok && (! stable || j == expected[i]);
+      }
+      return ok;
+    }
+
+    void check_sort_by_key(long n) {
+      bool ok = true;
+      bool stable_ok = true;
+      bool radix_ok = true;
+      for (long sz : sizes(n)) {
+        std::vector<int> ints;
+        std::vector<long> longs;
+        std::vector<double> doubles;
+        for (long i = 0; i < sz; i++) {
+          ints.push_back((int)(hash(i) % 100) - 50);
+          longs.push_back((hash(i) - 500000) * 1000000007L);
+          doubles.push_back((double)(hash(i) % 100) / 3.0);
+        }
+        ok = ok && sorts_by_key(ints, std::less<int>(), by_key_sort(), false)
+                && sorts_by_key(longs, std::less<long>(), by_key_sort(), false)
+                && sorts_by_key(doubles, std::less<double>(), by_key_sort(), false)
+                && sorts_by_key(ints, std::greater<int>(), by_key_sort(), false);
+        stable_ok = stable_ok && sorts_by_key(ints, std::less<int>(), by_key_stable_sort(), true)
+                && sorts_by_key(longs, std::less<long>(), by_key_stable_sort(), true)
+                && sorts_by_key(doubles, std::less<double>(), by_key_stable_sort(), true)
+                && sorts_by_key(ints, std::greater<int>(), by_key_stable_sort(), true);
+        radix_ok = radix_ok && sorts_by_key(ints, std::less<int>(), by_key_radix_sort(), true)
+                && sorts_by_key(longs, std::less<long>(), by_key_radix_sort(), true);
+      }
+      check("sort_by_key", ok);
+      check("stable_sort_by_key", stable_ok);
+      check("radix_sort_by_key", radix_ok);
+    }
+
+    void check_selection(long n) {
+      bool nth_ok = true;
+      bool partial_ok = true;
+      bool top_k_ok = true;
+      for (long sz : sizes(n)) {
+        // few distinct keys, and distinct keys
+        for (long nb_keys : { 3L, 1000003L }) {
+          std::vector<long> items;
+          for (long i = 0; i < sz; i++) {
+            items.push_back(hash(i) % nb_keys);
+          }
+          std::vector<long> sorted = items;
+          std::sort(sorted.begin(), sorted.end());
+          for (long k : { 0L, 1L, sz / 2, sz - 1 }) {
+            if (k < 0 || k >= sz) {
+              continue;
+            }
+            parray<long> xs(sz, [&] (long i) {
+              return items[i];
+            });
+            pasl::pctl::nth_element(xs.begin(), xs.begin() + k, xs.end(), std::less<long>());
+            long x = xs[k];
+            nth_ok = nth_ok && (x == sorted[k]);
+            for (long i = 0; i < sz; i++) {
+              nth_ok = nth_ok && ((i < k) ? (xs[i] <= x) : (xs[i] >= x));
+            }
+            std::vector<long> permuted(xs.cbegin(), xs.cend());
+            std::sort(permuted.begin(), permuted.end());
+            nth_ok = nth_ok && (permuted == sorted);
+          }
+          for (long m : { 0L, 1L, 10L, sz / 3, sz }) {
+            m = std::min(m, sz);
+            parray<long> xs(sz, [&] (long i) {
+              return items[i];
+            });
+            pasl::pctl::partial_sort(xs.begin(), xs.begin() + m, xs.end(), std::less<long>());
+            std::vector<long> expected(sorted.begin(), sorted.begin() + m);
+            partial_ok = partial_ok && same_items(xs.cbegin(), xs.cbegin() + m, expected);
+            std::vector<long> permuted(xs.cbegin(), xs.cend());
+            std::sort(permuted.begin(), permuted.end());
+            partial_ok = partial_ok && (permuted == sorted);
+          }
+          parray<long> xs(sz, [&] (long i) {
+            return items[i];
+          });
+          for (long k : { 0L, 1L, 10L, (long)PSORT_TOPK_MAX_HEAP + 1, sz, sz + 5 }) {
+            std::vector<long> expected(sorted.begin(), sorted.begin() + std::min(k, sz));
+            parray<long> ts = top_k(xs.cbegin(), xs.cend(), k, std::less<long>());
+            top_k_ok = top_k_ok && same_items(ts.cbegin(), ts.cend(), expected);
+          }
+          // the input is left untouched
+          top_k_ok = top_k_ok && same_items(xs.cbegin(), xs.cend(), items);
+        }
+      }
+      check("nth_element", nth_ok);
+      check("partial_sort", partial_ok);
+      check("top_k", top_k_ok);
+    }
+
+    void ex() {
+      long n = pasl::util::cmdline::parse_or_default_long("n", 100000);
+      check_signed_zeros(n);
+      check_duplicates(n);
+      check_batch_bounds(n);
+      check_radix_sort(n);
+      check_mergesort(n);
+      check_merge(n);
+      check_kway_merge(n);
+      check_quicksort(n);
+      check_sort_by_key(n);
+      check_selection(n);
+    }
+  }
+}
+
+/*---------------------------------------------------------------------*/
+
+int main(int argc, char** argv) {
+  pbbs::launch(argc, argv, [&] {
+    pasl::pctl::ex();
+  });
+  return pasl::pctl::all_ok ? 0 : 1;
+}
+
+/***********************************************************************/
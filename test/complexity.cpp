@@ -0,0 +1,244 @@
+/*!
+ * \file complexity.cpp
+ * \brief Checks the complexity measures of the sorting and set operations
+ * \date 2015
+ * \copyright COPYRIGHT (c) 2015 Umut Acar, Arthur Chargueraud, and
+ * Michael Rainey. All rights reserved.
+ * \license This project is released under the GNU Public License.
+ *
+ * The granularity controller predicts the running time of a sequential
+ * body as the complexity of the body times a constant learned per
+ * controlled statement. This constant is only meaningful if it does not
+ * depend on the size of the input. This program runs the sequential
+ * alternatives of the controlled statements of psort.hpp and pset.hpp on
+ * inputs of sizes 2^min_lg to 2^max_lg, and computes for each operation
+ * the ratio between the running time and the complexity measure used by
+ * the controller. The spread of a measure is its largest ratio over its
+ * smallest one. Each ratio is the smallest one over `-repeat` runs, to
+ * filter out noise on small inputs.
+ *
+ * A measure passes if (1) its spread is at most `-tolerance`, and (2)
+ * its spread is smaller than that of a deliberately wrong alternative,
+ * e.g., n instead of n log n, m log n instead of m log (n / m) for the
+ * batched search, or n + m for the union of a small set into a large
+ * one. With the default sizes, a measure that misses or adds a
+ * logarithmic factor drifts by a factor of max_lg / min_lg = 2.4,
+ * which exceeds the default tolerance.
+ *
+ * The program exits with a nonzero status if some measure fails.
+ *
+ * Usage: complexity.opt -min_lg 10 -max_lg 24 -repeat 5 -tolerance 2 [-op mergesort]
+ */
+
+#define PCTL_SEQUENTIAL_BASELINE
+
+#include "example.hpp"
+#include "io.hpp"
+#include "psort.hpp"
+#include "pchunkedseq.hpp"
+#include "pset.hpp"
+#include "cmdline.hpp"
+#include <chrono>
+#include <cmath>
+#include <functional>
+
+/***********************************************************************/
+
+namespace pasl {
+  namespace pctl {
+
+    using function_type = std::function<double(long)>;
+
+    class operation {
+    public:
+      std::string name;
+      function_type time;        // running time on an input of size n
+      function_type measure;     // complexity measure used by the controller
+      function_type alternative; // wrong measure, which must be detected
+    };
+
+    // inputs are made of distinct keys in a scrambled order
+    parray<long> scrambled(long n, long seed) {
+      return parray<long>(n, [&] (long i) {
+        return (long)(((i + seed) * 2654435761L) % (4 * n));
+      });
+    }
+
+    template <class Body>
+    double time_of(const Body& body) {
+      auto start = std::chrono::system_clock::now();
+      body();
+      auto end = std::chrono::system_clock::now();
+      std::chrono::duration<double> diff = end - start;
+      return diff.count();
+    }
+
+    auto compare = [] (long x, long y) {
+      return x < y;
+    };
+
+    double linear(long n) {
+      return (double)n;
+    }
+
+    double sorting(long n) {
+      return sort_complexity(n);
+    }
+
+    double merging(long n) {
+      return merge_complexity(n / 2, n - n / 2);
+    }
+
+    long sqrt_of(long n) {
+      return std::max(1L, (long)std::sqrt((double)n));
+    }
+
+    // operations on two sets of n1 and n2 items
+    template <class Set_operation>
+    double time_of_pset_operation(long n1, long n2, const Set_operation& f) {
+      parray<long> xs = scrambled(n1, 0);
+      parray<long> ys = scrambled(n2, 1);
+      pset<long> s1(xs.begin(), xs.end());
+      pset<long> s2(ys.begin(), ys.end());
+      return time_of([&] { f(s1, s2); });
+    }
+
+    std::vector<operation> operations() {
+      std::vector<operation> ops;
+      ops.push_back({ "mergesort", [] (long n) {
+        parray<long> xs = scrambled(n, 0);
+        return time_of([&] { mergesort(xs.begin(), xs.end(), compare); });
+      }, sorting, linear });
+      ops.push_back({ "quicksort", [] (long n) {
+        parray<long> xs = scrambled(n, 0);
+        return time_of([&] { quicksort(xs.begin(), xs.end(), compare); });
+      }, sorting, linear });
+      // runs of length 16, so that the run merging dominates
+      ops.push_back({ "natural_mergesort", [] (long n) {
+        parray<long> xs = scrambled(n, 0);
+        for (long i = 0; i < n; i += 16) {
+          std::sort(xs.begin() + i, xs.begin() + std::min(n, i + 16));
+        }
+        return time_of([&] { natural_mergesort(xs.begin(), xs.end(), compare); });
+      }, [] (long n) {
+        return merge_runs_complexity(n, std::max(1L, n / 16));
+      }, linear });
+      ops.push_back({ "merge", [] (long n) {
+        parray<long> xs = scrambled(n / 2, 0);
+        parray<long> ys = scrambled(n - n / 2, 1);
+        std::sort(xs.begin(), xs.end());
+        std::sort(ys.begin(), ys.end());
+        parray<long> zs(n);
+        return time_of([&] {
+          merge(xs.cbegin(), xs.cend(), ys.cbegin(), ys.cend(), zs.begin(), compare);
+        });
+      }, merging, sorting });
+      // n / 16 queries, so that a measure in m log n would drift
+      ops.push_back({ "batch_search", [] (long n) {
+        parray<long> xs = scrambled(n, 0);
+        std::sort(xs.begin(), xs.end());
+        long m = std::max(1L, n / 16);
+        // queries spread over the whole range of keys
+        parray<long> qs(m, [&] (long i) {
+          return (long)(((i + 1) * 2654435761L) % (4 * n));
+        });
+        std::sort(qs.begin(), qs.end());
+        return time_of([&] {
+          sorted_batch_lower_bound(xs.cbegin(), xs.cend(), qs.cbegin(), qs.cend());
+        });
+      }, [] (long n) {
+        return search_complexity(std::max(1L, n / 16), n);
+      }, [] (long n) {
+        return std::max(1L, n / 16) * log2_of(n);
+      } });
+      ops.push_back({ "pset_build", [] (long n) {
+        parray<long> xs = scrambled(n, 0);
+        return time_of([&] { pset<long> s(xs.begin(), xs.end()); });
+      }, sorting, linear });
+      auto set_operation = [] (long n) {
+        return set_operation_complexity(n / 2, n - n / 2);
+      };
+      ops.push_back({ "pset_merge", [] (long n) {
+        return time_of_pset_operation(n / 2, n - n / 2, [] (pset<long>& s1, pset<long>& s2) { s1.merge(s2); });
+      }, set_operation, sorting });
+      ops.push_back({ "pset_intersect", [] (long n) {
+        return time_of_pset_operation(n / 2, n - n / 2, [] (pset<long>& s1, pset<long>& s2) { s1.intersect(s2); });
+      }, set_operation, sorting });
+      ops.push_back({ "pset_diff", [] (long n) {
+        return time_of_pset_operation(n / 2, n - n / 2, [] (pset<long>& s1, pset<long>& s2) { s1.diff(s2); });
+      }, set_operation, sorting });
+      // sqrt(n) items merged into n, so that a linear measure would drift
+      ops.push_back({ "pset_merge_small", [] (long n) {
+        return time_of_pset_operation(n, sqrt_of(n), [] (pset<long>& s1, pset<long>& s2) { s1.merge(s2); });
+      }, [] (long n) {
+        return set_operation_complexity(n, sqrt_of(n));
+      }, [] (long n) {
+        return merge_complexity(n, sqrt_of(n));
+      } });
+      return ops;
+    }
+
+    class spread_type {
+    public:
+      double lo = std::numeric_limits<double>::max();
+      double hi = 0.0;
+
+      void add(double r) {
+        lo = std::min(lo, r);
+        hi = std::max(hi, r);
+      }
+
+      double get() const {
+        return hi / std::max(lo, 1e-15);
+      }
+    };
+
+    bool ex() {
+      int min_lg = pasl::util::cmdline::parse_or_default_int("min_lg", 10);
+      int max_lg = pasl::util::cmdline::parse_or_default_int("max_lg", 24);
+      int repeat = pasl::util::cmdline::parse_or_default_int("repeat", 5);
+      double tolerance = pasl::util::cmdline::parse_or_default_double("tolerance", 2.0);
+      std::string op = pasl::util::cmdline::parse_or_default_string("op", "all");
+      bool ok = true;
+      for (auto& p : operations()) {
+        if (op != "all" && op != p.name) {
+          continue;
+        }
+        spread_type spread;
+        spread_type alternative_spread;
+        for (int lg = min_lg; lg <= max_lg; lg++) {
+          long n = 1L << lg;
+          double t = std::numeric_limits<double>::max();
+          for (int i = 0; i < repeat; i++) {
+            t = std::min(t, p.time(n));
+          }
+          spread.add(t / p.measure(n));
+          alternative_spread.add(t / p.alternative(n));
+          printf("%s n=%ld ns_per_unit %.4lf\n", p.name.c_str(), n, t / p.measure(n) * 1e9);
+        }
+        bool converges = spread.get() <= tolerance;
+        bool discriminates = spread.get() < alternative_spread.get();
+        ok = ok && converges && discriminates;
+        printf("%s spread %.2lf alternative_spread %.2lf %s\n",
+               p.name.c_str(), spread.get(), alternative_spread.get(),
+               ! converges ? "diverges" : ! discriminates ? "undetermined" : "ok");
+      }
+      if (! ok) {
+        std::cerr << "some complexity measures fail" << std::endl;
+      }
+      return ok;
+    }
+  }
+}
+
+/*---------------------------------------------------------------------*/
+
+int main(int argc, char** argv) {
+  bool ok = false;
+  pbbs::launch(argc, argv, [&] {
+    ok = pasl::pctl::ex();
+  });
+  return ok ? 0 : 1;
+}
+
+/***********************************************************************/
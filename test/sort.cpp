@@ -0,0 +1,66 @@
+/*!
+ * \file sort.cpp
+ * \brief Benchmarking script for parallel sorting algorithms
+ * \date 2015
+ * \copyright COPYRIGHT (c) 2015 Umut Acar, Arthur Chargueraud, and
+ * Michael Rainey. All rights reserved.
+ * \license This project is released under the GNU Public License.
+ *
+ */
+
+#include "example.hpp"
+#include "io.hpp"
+#include "psort.hpp"
+#include "cmdline.hpp"
+#include <chrono>
+
+/***********************************************************************/
+
+namespace pasl {
+  namespace pctl {
+    void ex() {
+      long n = pasl::util::cmdline::parse_or_default_long("n", 10000000);
+      std::string algo = pasl::util::cmdline::parse_or_default_string("algo", "mergesort");
+      parray<double> xs(n, [&] (long i) {
+        return (double)((i * 2654435761L) % n);
+      });
+      auto compare = [&] (double x, double y) {
+        return x < y;
+      };
+      auto start = std::chrono::system_clock::now();
+      if (algo == "mergesort") {
+        mergesort(xs.begin(), xs.end(), compare);
+      } else if (algo == "samplesort") {
+        samplesort(xs.begin(), xs.end(), compare);
+      } else if (algo == "std") {
+        std::sort(xs.begin(), xs.end(), compare);
+      } else {
+        std::cerr << "unknown algorithm " << algo << std::endl;
+        return;
+      }
+      auto end = std::chrono::system_clock::now();
+      std::chrono::duration<float> diff = end - start;
+      printf ("exectime %.3lf\n", diff.count());
+      for (long i = 1; i < n; i++) {
+        if (xs[i] < xs[i - 1]) {
+          std::cerr << "not sorted at position " << i << std::endl;
+          return;
+        }
+      }
+    }
+  }
+}
+
+/*---------------------------------------------------------------------*/
+
+int main(int argc, char** argv) {
+  pbbs::launch(argc, argv, [&] {
+    pasl::pctl::ex();
+#ifdef LOGGING
+    pasl::pctl::logging::dump();
+#endif
+  });
+  return 0;
+}
+
+/***********************************************************************/